@@ -16,6 +16,9 @@
  */
 #pragma once
 
+#include <ostream>
+#include <utility>
+
 // Range (in bytes) we consider false sharing can occur. You may
 // expect this to be a single cache line (64B on x86-64), but on
 // Sandybridge (at least) it has been observed that pairs of
@@ -48,7 +51,7 @@ public:
     explicit CachelinePadded(Args&&... args)
         : item(std::forward<Args>(args)...) {}
 
-    CachelinePadded() {}
+    CachelinePadded() : item() {}
 
     T* get() {
       return &item;
@@ -17,12 +17,32 @@
 
 #pragma once
 
+#include <platform/cacheline_padded.h>
+#include <platform/make_unique.h>
+#include <platform/numa_memory.h>
 #include <platform/sysinfo.h>
 
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <new>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+namespace cb {
+/**
+ * Tag used to create a CoreStore where the element of each core is
+ * allocated on the NUMA node of the core
+ */
+struct numa_local_t {
+    explicit numa_local_t() = default;
+};
+constexpr numa_local_t numa_local{};
+} // namespace cb
+
 /**
  * Store T to an element associated with the current "core" (cb::get_cpu_index)
  *
@@ -31,47 +51,313 @@
  * The iterator (begin/end) allow a caller to access all elements e.g so all T
  * can be summed
  *
+ * By default each element is padded (and aligned) to the false sharing
+ * range (see CachelinePadded) so that the elements of neighbouring cores
+ * don't share cache lines. The elements may also be allocated on the NUMA
+ * node of their core (so that the memory of the per-core elements is
+ * local to the socket using it):
+ *
+ *     CoreStore<std::atomic<uint64_t>> counters(cb::numa_local);
+ *
  * @tparam T type to be stored
+ * @tparam Padded if each element should be padded to the false sharing
+ *                range
  */
-template <typename T>
+template <typename T, bool Padded = true>
 class CoreStore {
 public:
-    using const_iterator = typename std::vector<T>::const_iterator;
-    using iterator = typename std::vector<T>::iterator;
+    /// The type of the slot holding the element for each core
+    using slot_type = typename std::
+            conditional<Padded, cb::CachelinePadded<T>, T>::type;
+
+    /// A random access iterator over the elements (in the order of the
+    /// cores)
+    template <typename Value, typename Store>
+    class Iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = typename std::remove_const<Value>::type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Value*;
+        using reference = Value&;
+
+        Iterator() = default;
+
+        Iterator(Store* store, size_t index) : store(store), index(index) {
+        }
+
+        Value& operator*() const {
+            return unwrap(store->slot(index));
+        }
+
+        Value* operator->() const {
+            return &**this;
+        }
+
+        Value& operator[](difference_type n) const {
+            return unwrap(store->slot(index + n));
+        }
+
+        Iterator& operator++() {
+            ++index;
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            auto ret = *this;
+            ++index;
+            return ret;
+        }
+
+        Iterator& operator--() {
+            --index;
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            auto ret = *this;
+            --index;
+            return ret;
+        }
+
+        Iterator& operator+=(difference_type n) {
+            index += n;
+            return *this;
+        }
+
+        Iterator& operator-=(difference_type n) {
+            index -= n;
+            return *this;
+        }
+
+        Iterator operator+(difference_type n) const {
+            return Iterator(store, index + n);
+        }
+
+        friend Iterator operator+(difference_type n, const Iterator& it) {
+            return it + n;
+        }
+
+        Iterator operator-(difference_type n) const {
+            return Iterator(store, index - n);
+        }
+
+        difference_type operator-(const Iterator& other) const {
+            return difference_type(index) - difference_type(other.index);
+        }
+
+        bool operator==(const Iterator& other) const {
+            return index == other.index;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return index != other.index;
+        }
 
-    CoreStore() : coreArray(cb::get_cpu_count()) {
+        bool operator<(const Iterator& other) const {
+            return index < other.index;
+        }
+
+        bool operator>(const Iterator& other) const {
+            return index > other.index;
+        }
+
+        bool operator<=(const Iterator& other) const {
+            return index <= other.index;
+        }
+
+        bool operator>=(const Iterator& other) const {
+            return index >= other.index;
+        }
+
+    private:
+        Store* store = nullptr;
+        size_t index = 0;
+    };
+
+    using const_iterator = Iterator<const T, const CoreStore>;
+    using iterator = Iterator<T, CoreStore>;
+
+    CoreStore() {
+        create(false);
     }
 
+    /**
+     * Create a CoreStore where each element is constructed with the
+     * given arguments
+     */
+    template <typename... Args,
+              typename = typename std::enable_if<
+                      std::is_constructible<T, Args...>::value>::type>
+    explicit CoreStore(Args&&... args) {
+        create(false, args...);
+    }
+
+    /**
+     * Create a CoreStore where the element of each core is allocated on
+     * the NUMA node of the core (cb::get_numa_node) and constructed with
+     * the given arguments. The elements of each node are allocated in
+     * a separate mapping, so the store uses at least one page per node.
+     *
+     * @throws std::system_error if the memory can't be allocated
+     */
+    template <typename... Args,
+              typename = typename std::enable_if<
+                      std::is_constructible<T, Args...>::value>::type>
+    explicit CoreStore(cb::numa_local_t, Args&&... args) {
+        create(true, args...);
+    }
+
+    CoreStore(const CoreStore&) = delete;
+    CoreStore& operator=(const CoreStore&) = delete;
+
+    ~CoreStore() {
+        destroy(count);
+    }
+
+    /**
+     * Get the element for the current core
+     *
+     * @throws std::out_of_range if the current core is outside of the
+     *         cores known when the store was created
+     * @throws std::system_error if the current core can't be determined
+     */
     T& get() {
         auto index = cb::get_cpu_index();
-        if (index > coreArray.size()) {
+        if (index >= count) {
             throw std::out_of_range("CoreStore::get index:" +
                                     std::to_string(index) + " out of bounds:" +
-                                    std::to_string(coreArray.size()));
+                                    std::to_string(count));
+        }
+        return unwrap(slot(index));
+    }
+
+    /**
+     * Get the element for the current core without throwing (for the hot
+     * paths using the store as shards; any element may be returned if the
+     * current core isn't known).
+     */
+    T& get(std::nothrow_t) noexcept {
+        auto index = cb::get_cpu_index(std::nothrow);
+        if (index >= count) {
+            index %= count;
         }
-        return coreArray.at(index);
+        return unwrap(slot(index));
     }
 
     size_t size() const {
-        return coreArray.size();
+        return count;
     }
 
     const_iterator begin() const {
-        return coreArray.begin();
+        return const_iterator(this, 0);
     }
 
     const_iterator end() const {
-        return coreArray.end();
+        return const_iterator(this, count);
     }
 
     iterator begin() {
-        return coreArray.begin();
+        return iterator(this, 0);
     }
 
     iterator end() {
-        return coreArray.end();
+        return iterator(this, count);
     }
 
 private:
-    std::vector<T> coreArray;
+    static T& unwrap(cb::CachelinePadded<T>& slot) {
+        return *slot;
+    }
+
+    static const T& unwrap(const cb::CachelinePadded<T>& slot) {
+        return *slot;
+    }
+
+    static T& unwrap(T& slot) {
+        return slot;
+    }
+
+    static const T& unwrap(const T& slot) {
+        return slot;
+    }
+
+    /**
+     * Get the slot of the given core. The slots are indexed directly
+     * unless they're spread over the NUMA nodes (where the address of
+     * each slot is looked up in a table).
+     */
+    slot_type& slot(size_t index) {
+        return (numaSlots == nullptr) ? base[index] : *numaSlots[index];
+    }
+
+    const slot_type& slot(size_t index) const {
+        return (numaSlots == nullptr) ? base[index] : *numaSlots[index];
+    }
+
+    /**
+     * Allocate the memory for the slots and construct the elements
+     */
+    template <typename... Args>
+    void create(bool numaLocal, Args&... args) {
+        count = cb::get_cpu_count();
+        if (numaLocal) {
+            numaSlots.reset(new slot_type*[count]);
+            std::map<size_t, std::vector<size_t>> nodes;
+            for (size_t cpu = 0; cpu < count; ++cpu) {
+                nodes[cb::get_numa_node(cpu)].push_back(cpu);
+            }
+            for (const auto& node : nodes) {
+                const auto& cpus = node.second;
+                numaMemory.emplace_back(std::make_unique<cb::NumaMemory>(
+                        cpus.size() * sizeof(slot_type), node.first));
+                auto* nodeBase = reinterpret_cast<slot_type*>(
+                        numaMemory.back()->data());
+                for (size_t ii = 0; ii < cpus.size(); ++ii) {
+                    numaSlots[cpus[ii]] = nodeBase + ii;
+                }
+            }
+        } else {
+            // operator new doesn't respect the alignment of over-aligned
+            // types (before C++17) so align the slots ourselves
+            size_t space = count * sizeof(slot_type) + alignof(slot_type);
+            storage.reset(new char[space]);
+            void* aligned = storage.get();
+            std::align(alignof(slot_type),
+                       count * sizeof(slot_type),
+                       aligned,
+                       space);
+            base = static_cast<slot_type*>(aligned);
+        }
+
+        size_t constructed = 0;
+        try {
+            for (; constructed < count; ++constructed) {
+                new (&slot(constructed)) slot_type(args...);
+            }
+        } catch (...) {
+            destroy(constructed);
+            throw;
+        }
+    }
+
+    /**
+     * Destroy the elements in the first num slots
+     */
+    void destroy(size_t num) {
+        for (size_t ii = 0; ii < num; ++ii) {
+            slot(ii).~slot_type();
+        }
+    }
+
+    /// The number of slots (one per core)
+    size_t count = 0;
+    /// The slots (indexed by core) when not allocated per NUMA node
+    slot_type* base = nullptr;
+    /// The memory for base
+    std::unique_ptr<char[]> storage;
+    /// The slot of each core when they're allocated per NUMA node
+    std::unique_ptr<slot_type*[]> numaSlots;
+    /// The memory for the slots of each NUMA node
+    std::vector<std::unique_ptr<cb::NumaMemory>> numaMemory;
 };
@@ -64,3 +64,9 @@
  * Defined if std::make_unique is defined in <memory>
  */
 #cmakedefine HAVE_MAKE_UNIQUE
+
+/**
+ * Defined if glibc registers a restartable sequences (rseq) area for each
+ * thread (and exports __rseq_offset / __rseq_size in <sys/rseq.h>)
+ */
+#cmakedefine HAVE_RSEQ
@@ -0,0 +1,374 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/histogram.h>
+#include <platform/sized_buffer.h>
+#include <relaxed_atomic.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+namespace cb {
+
+namespace detail {
+constexpr bool fixedHistogramBoundsIncreasing(uint64_t) {
+    return true;
+}
+
+template <typename... Rest>
+constexpr bool fixedHistogramBoundsIncreasing(uint64_t first,
+                                              uint64_t second,
+                                              Rest... rest) {
+    return first < second && fixedHistogramBoundsIncreasing(second, rest...);
+}
+
+constexpr bool fixedHistogramBoundsAtMost(uint64_t) {
+    return true;
+}
+
+template <typename... Rest>
+constexpr bool fixedHistogramBoundsAtMost(uint64_t max,
+                                          uint64_t first,
+                                          Rest... rest) {
+    return first <= max && fixedHistogramBoundsAtMost(max, rest...);
+}
+
+template <typename T>
+constexpr uint64_t fixedHistogramToRaw(T value) {
+    // Dividing two durations returns a value of the underlying Rep.
+    return uint64_t(value / T(1));
+}
+} // namespace detail
+
+/**
+ * A histogram where the bin boundaries are known at compile time.
+ *
+ * The boundaries are given as template arguments (as raw values; the
+ * count of a duration, and they must fit in T) and split the range of T
+ * into sizeof...(Bounds) + 1 bins:
+ *
+ *     [Limits::min(), B0), [B0, B1), ... [Bn-1, Limits::max()]
+ *
+ * Compared to Histogram<T> the counters are stored inline (so creating
+ * the histogram doesn't allocate any memory or run a generator) and the
+ * bin for a value is computed by comparing it to all of the boundaries
+ * and adding up the results (which the compiler unrolls into a short
+ * branch free sequence instead of a binary search).
+ *
+ *     // Same bins as the default MicrosecondHistogram
+ *     cb::MicrosecondFixedExponentialHistogram histogram;
+ *
+ *     // Bins for the size of documents
+ *     cb::FixedHistogram<uint32_t, std::numeric_limits,
+ *                        256, 1024, 4096, 16384, 65536> sizes;
+ *
+ * The histogram provides the same interface as the other histograms
+ * (add, getBin, iteration, percentile, merge etc) and may be used with
+ * GenericBlockTimer.
+ *
+ * The histogram tracks non-negative values only.
+ */
+template <typename T, template <class> class Limits, uint64_t... Bounds>
+class FixedHistogram {
+public:
+    static_assert(sizeof...(Bounds) > 0,
+                  "FixedHistogram needs at least one boundary");
+    static_assert(detail::fixedHistogramBoundsIncreasing(Bounds...),
+                  "FixedHistogram boundaries must be strictly increasing");
+    static_assert(detail::fixedHistogramBoundsAtMost(
+                          detail::fixedHistogramToRaw(Limits<T>::max()),
+                          Bounds...),
+                  "FixedHistogram boundaries must fit in T");
+
+    /// The number of bins in the histogram
+    static constexpr size_t numBins = sizeof...(Bounds) + 1;
+
+    /**
+     * A view of a single bin in the histogram
+     */
+    class Bin {
+    public:
+        Bin(const FixedHistogram& h, size_t i) : histogram(&h), index(i) {
+        }
+
+        /**
+         * The starting value of this histogram bin (inclusive).
+         */
+        T start() const {
+            if (index == 0) {
+                return Limits<T>::min();
+            }
+            return T(bounds()[index - 1]);
+        }
+
+        /**
+         * The ending value of this histogram bin (exclusive). The last bin
+         * reaches to the largest possible value.
+         */
+        T end() const {
+            if (index == numBins - 1) {
+                return Limits<T>::max();
+            }
+            return T(bounds()[index]);
+        }
+
+        /**
+         * The count in this bin.
+         */
+        size_t count() const {
+            return histogram->counts[index].load();
+        }
+
+        // Allow the bin to be used like the unique_ptr<HistogramBin> the
+        // iterator of Histogram<T> returns
+        const Bin* operator->() const {
+            return this;
+        }
+
+        const Bin& operator*() const {
+            return *this;
+        }
+
+        // How to print a bin (durations are printed as their count)
+        friend std::ostream& operator<<(std::ostream& out, const Bin& b) {
+            out << "[" << toRaw(b.start()) << ", " << toRaw(b.end())
+                << ") = " << b.count();
+            return out;
+        }
+
+    private:
+        const FixedHistogram* histogram;
+        size_t index;
+    };
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Bin;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Bin*;
+        using reference = Bin;
+
+        const_iterator(const FixedHistogram& h, size_t i)
+            : histogram(&h), index(i) {
+        }
+
+        Bin operator*() const {
+            return Bin(*histogram, index);
+        }
+
+        const_iterator& operator++() {
+            ++index;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto ret = *this;
+            ++index;
+            return ret;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return index == other.index && histogram == other.histogram;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        const FixedHistogram* histogram;
+        size_t index;
+    };
+
+    using bin_type = Bin;
+    using value_type = Bin;
+    using iterator = const_iterator;
+
+    FixedHistogram() = default;
+
+    // Deleted to avoid copying by accident (use merge)
+    FixedHistogram(const FixedHistogram&) = delete;
+    FixedHistogram& operator=(const FixedHistogram&) = delete;
+
+    /**
+     * Get the index of the bin counting the given value
+     */
+    static size_t indexOf(T value) {
+        // Count the boundaries <= value (the loop has a fixed number of
+        // iterations and no branches so it is unrolled / vectorized)
+        const uint64_t raw = toRaw(value);
+        size_t index = 0;
+        for (const auto bound : bounds()) {
+            index += size_t(raw >= bound);
+        }
+        return index;
+    }
+
+    /**
+     * Add a value to this histogram.
+     *
+     * @param amount the size of the thing being added
+     * @param count the quantity at this size being added
+     */
+    void add(T amount, size_t count = 1) {
+        counts[indexOf(amount)].fetch_add(count);
+    }
+
+    /**
+     * Add a batch of values to this histogram (counting them locally
+     * and doing a single atomic add for each bin).
+     *
+     * @param values the values to add
+     */
+    void add(cb::sized_buffer<const T> values) {
+        std::array<size_t, numBins> local{};
+        for (const auto& value : values) {
+            ++local[indexOf(value)];
+        }
+        for (size_t ii = 0; ii < numBins; ++ii) {
+            if (local[ii] != 0) {
+                counts[ii].fetch_add(local[ii]);
+            }
+        }
+    }
+
+    /**
+     * Get the bin servicing the given sized input.
+     */
+    Bin getBin(T amount) const {
+        return Bin(*this, indexOf(amount));
+    }
+
+    /**
+     * Set all bins to 0.
+     */
+    void reset() {
+        for (auto& count : counts) {
+            count.reset();
+        }
+    }
+
+    /**
+     * Get the total number of samples counted.
+     */
+    size_t total() const {
+        size_t ret = 0;
+        for (const auto& count : counts) {
+            ret += count.load();
+        }
+        return ret;
+    }
+
+    /**
+     * Get the value at the given percentile (interpolated within the bin
+     * containing it). See cb::getHistogramPercentile.
+     *
+     * @param percentile the requested percentile [0, 100]
+     * @throws std::invalid_argument if percentile is outside [0, 100]
+     */
+    T percentile(double percentile) const {
+        return getHistogramPercentile<T, Limits>(begin(), end(), percentile);
+    }
+
+    /**
+     * Add the counts from another histogram (the bins are the same as
+     * that is given by the type).
+     */
+    void merge(const FixedHistogram& other) {
+        for (size_t ii = 0; ii < numBins; ++ii) {
+            const auto count = other.counts[ii].load();
+            if (count != 0) {
+                counts[ii].fetch_add(count);
+            }
+        }
+    }
+
+    size_t size() const {
+        return numBins;
+    }
+
+    const_iterator begin() const {
+        return const_iterator(*this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(*this, numBins);
+    }
+
+    /**
+     * Convert a value to the raw value compared with the boundaries
+     */
+    static constexpr uint64_t toRaw(T value) {
+        return detail::fixedHistogramToRaw(value);
+    }
+
+private:
+    static const std::array<uint64_t, numBins - 1>& bounds() {
+        static constexpr std::array<uint64_t, numBins - 1> ret{{Bounds...}};
+        return ret;
+    }
+
+    std::array<Couchbase::RelaxedAtomic<size_t>, numBins> counts;
+};
+
+template <typename T, template <class> class Limits, uint64_t... Bounds>
+constexpr size_t FixedHistogram<T, Limits, Bounds...>::numBins;
+
+/**
+ * FixedHistogram of durations measured in microseconds.
+ */
+template <uint64_t... Bounds>
+using MicrosecondFixedHistogram =
+        FixedHistogram<UnsignedMicroseconds, cb::duration_limits, Bounds...>;
+
+/**
+ * FixedHistogram with the same bins as the default MicrosecondHistogram
+ * ([0, 1), [1, 2), [2, 4) ... [2^30, max]).
+ */
+using MicrosecondFixedExponentialHistogram =
+        MicrosecondFixedHistogram<1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024,
+                                  2048, 4096, 8192, 16384, 32768, 65536,
+                                  131072, 262144, 524288, 1048576, 2097152,
+                                  4194304, 8388608, 16777216, 33554432,
+                                  67108864, 134217728, 268435456, 536870912,
+                                  1073741824>;
+
+// How to print a histogram.
+template <typename T, template <class> class Limits, uint64_t... Bounds>
+std::ostream& operator<<(std::ostream& out,
+                         const FixedHistogram<T, Limits, Bounds...>& h) {
+    out << "{FixedHistogram: ";
+    bool needComma(false);
+    for (const auto& bin : h) {
+        if (needComma) {
+            out << ", ";
+        }
+        out << bin;
+        needComma = true;
+    }
+    out << "}";
+    return out;
+}
+
+} // namespace cb
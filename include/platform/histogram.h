@@ -20,14 +20,18 @@
 #include <platform/make_unique.h>
 #include <platform/platform.h>
 #include <platform/processclock.h>
+#include <platform/sized_buffer.h>
+#include <platform/slow_block_reporter.h>
 #include <relaxed_atomic.h>
 
 #include <algorithm>
+#include <array>
 #include <chrono>
 #include <cmath>
 #include <functional>
 #include <iostream>
 #include <numeric>
+#include <stdexcept>
 #include <vector>
 
 // Custom microseconds duration used for measuring histogram stats.
@@ -44,10 +48,10 @@ struct duration_limits {};
 
 template <>
 struct duration_limits<UnsignedMicroseconds> {
-    static UnsignedMicroseconds max() {
+    static constexpr UnsignedMicroseconds max() {
         return UnsignedMicroseconds::max();
     }
-    static UnsignedMicroseconds min() {
+    static constexpr UnsignedMicroseconds min() {
         return UnsignedMicroseconds::min();
     }
 };
@@ -110,6 +114,13 @@ private:
         _count.store(val);
     }
 
+    /**
+     * Set a specific value for this bin and return the previous value.
+     */
+    size_t exchange(size_t val) {
+        return _count.exchange(val);
+    }
+
     /**
      * Does this bin contain the given value?
      *
@@ -236,6 +247,64 @@ private:
     double _power;
 };
 
+namespace cb {
+/**
+ * Get the value at the given percentile of the samples counted in a
+ * histogram (used by the different histogram classes).
+ *
+ * The bins are visited in order until the bin containing the requested
+ * rank is found, and the value is interpolated linearly within that bin
+ * (assuming the samples in the bin are evenly distributed). The bin
+ * reaching to the largest possible value is open ended, so its start is
+ * returned.
+ *
+ * @param begin iterator to the first bin (dereferencing the iterator must
+ *              provide ->start(), ->end() and ->count())
+ * @param end iterator past the last bin
+ * @param percentile the requested percentile [0, 100]
+ * @return the value at the given percentile (or Limits::min() if the
+ *         histogram is empty)
+ * @throws std::invalid_argument if percentile is outside [0, 100]
+ */
+template <typename T, template <class> class Limits, typename Iterator>
+T getHistogramPercentile(Iterator begin, Iterator end, double percentile) {
+    if (!(percentile >= 0.0 && percentile <= 100.0)) {
+        throw std::invalid_argument(
+                "getHistogramPercentile: percentile must be in the range "
+                "[0, 100]");
+    }
+
+    size_t total = 0;
+    for (auto it = begin; it != end; ++it) {
+        total += (*it)->count();
+    }
+    if (total == 0) {
+        return Limits<T>::min();
+    }
+
+    // Dividing two durations returns a value of the underlying Rep.
+    using rep_type = decltype(T(1) / T(1));
+    const double rank = std::max(1.0, percentile / 100.0 * total);
+    size_t cumulative = 0;
+    for (auto it = begin; it != end; ++it) {
+        const auto& bin = *it;
+        const auto count = bin->count();
+        if (count == 0 || double(cumulative + count) < rank) {
+            cumulative += count;
+            continue;
+        }
+        if (bin->end() == Limits<T>::max()) {
+            return bin->start();
+        }
+        const double fraction = (rank - cumulative) / count;
+        const double start = double(bin->start() / T(1));
+        const double width = double(bin->end() / T(1)) - start;
+        return static_cast<T>(rep_type(start + width * fraction));
+    }
+    return Limits<T>::max();
+}
+} // namespace cb
+
 // UnsignedMicroseconds stream operator required for Histogram::verify()
 // so the type can be printed.
 inline std::ostream& operator<<(std::ostream& os,
@@ -302,6 +371,17 @@ public:
      */
     void add(T amount, size_t count = 1);
 
+    /**
+     * Add a batch of values to this histogram.
+     *
+     * The values are counted in a local array first, and then a single
+     * atomic add is done for each bin which was hit (instead of one per
+     * value).
+     *
+     * @param values the values to add
+     */
+    void add(cb::sized_buffer<const T> values);
+
     /**
      * Get the bin servicing the given sized input.
      */
@@ -321,6 +401,66 @@ public:
      */
     size_t total();
 
+    /**
+     * Get the value at the given percentile (interpolated within the bin
+     * containing it). See cb::getHistogramPercentile.
+     *
+     * @param percentile the requested percentile [0, 100]
+     * @throws std::invalid_argument if percentile is outside [0, 100]
+     */
+    T percentile(double percentile) const;
+
+    /**
+     * Add the counts from another histogram with identical bins to this
+     * histogram.
+     *
+     * @param other the histogram to add the counts from
+     * @throws std::invalid_argument if the histograms have different bins
+     */
+    void merge(const Histogram& other);
+
+    /**
+     * Get a copy of this histogram.
+     *
+     * The copy is not affected by later calls to add(), so the bins and
+     * total() of the copy are consistent with each other while other
+     * threads keep recording values in this histogram. Each bin is read
+     * individually, so the copy may contain some (but not all) of the
+     * values added while the snapshot is taken.
+     */
+    Histogram snapshot() const;
+
+    /**
+     * Get a copy of this histogram and reset the bins in this histogram
+     * (like snapshot() followed by reset(), but without losing the values
+     * added in between).
+     *
+     * Each bin is atomically swapped with zero, so every value recorded
+     * by another thread is returned by exactly one call to drain(). This
+     * is intended for collecting the delta since the previous collection.
+     */
+    Histogram drain();
+
+    /**
+     * Encode the histogram in a compact binary form (suitable for
+     * shipping or keeping a history of histograms in memory).
+     *
+     * The bin boundaries are delta encoded and only the non-zero bins
+     * are included, with all integers stored as varints (see
+     * src/histogram_encoding.h for the details).
+     */
+    std::vector<uint8_t> encode() const;
+
+    /**
+     * Decode a histogram encoded by encode(). The returned histogram has
+     * the same bins as the encoded one (so they may be merged).
+     *
+     * @param encoded the encoded histogram
+     * @throws std::invalid_argument if the input isn't a valid encoded
+     *                               histogram
+     */
+    static Histogram decode(cb::const_byte_buffer encoded);
+
     /**
      * Get an iterator from the beginning of a histogram bin.
      */
@@ -344,6 +484,12 @@ public:
     }
 
 private:
+    /**
+     * Build a histogram from the given (already verified) bins
+     */
+    explicit Histogram(container_type&& bins)
+        : bins(std::move(bins)) {
+    }
 
     template<typename G>
     void fill(G& generator) {
@@ -395,7 +541,10 @@ using MicrosecondHistogram =
  * Times blocks automatically and records the values in a histogram.
  *
  * If THRESHOLD_MS is greater than zero, then any blocks taking longer than
- * THRESHOLD_MS to execute will be reported to stderr.
+ * THRESHOLD_MS to execute will be reported to stderr. The reports are
+ * handed over to cb::SlowBlockReporter which writes them (aggregated
+ * per name, at most once per second) from a background thread so the
+ * slow thread doesn't block on stderr.
  * Note this requires that a name is specified for the BlockTimer.
  */
 template<typename HISTOGRAM, uint64_t THRESHOLD_MS>
@@ -438,8 +587,8 @@ public:
         if (THRESHOLD_MS > 0) {
             const auto msec = std::make_unsigned<ProcessClock::rep>::type(std::chrono::duration_cast<std::chrono::milliseconds>(spent).count());
             if (name != nullptr && msec > THRESHOLD_MS) {
-                std::cerr << "BlockTimer<" << name
-                          << "> Took too long: " << msec << "ms" << std::endl;
+                cb::SlowBlockReporter::instance().report(
+                        name, std::chrono::milliseconds(msec));
             }
         }
     }
@@ -456,6 +605,116 @@ private:
  */
 typedef GenericBlockTimer<MicrosecondHistogram, 0> BlockTimer;
 
+/**
+ * A BlockTimer which only times one in SAMPLE_RATE executions of the
+ * block and records the value with a count of SAMPLE_RATE, so the
+ * histogram is (approximately) the same as if every execution was timed.
+ *
+ * GenericBlockTimer reads the clock twice for every block which is
+ * significant for blocks only taking a fraction of a microsecond. The
+ * skipped executions only decrement a thread local countdown (no clock
+ * reads and no atomic operations).
+ *
+ * Each thread keeps a countdown per destination histogram, so blocks
+ * recording into different histograms are sampled independently of how
+ * they're interleaved.
+ *
+ * If THRESHOLD_MS is greater than zero, then the sampled blocks taking
+ * longer than THRESHOLD_MS to execute will be reported through
+ * cb::SlowBlockReporter (as for GenericBlockTimer; aggregated per name
+ * and written from a background thread). The blocks which aren't sampled
+ * are never reported.
+ */
+template <typename HISTOGRAM, uint64_t SAMPLE_RATE, uint64_t THRESHOLD_MS = 0>
+class GenericSampledBlockTimer {
+public:
+    static_assert(SAMPLE_RATE > 0, "SAMPLE_RATE must be greater than zero");
+
+    /**
+     * Get a SampledBlockTimer that will store its values in the given
+     * histogram (see GenericBlockTimer for a description of the
+     * parameters).
+     */
+    GenericSampledBlockTimer(HISTOGRAM* d,
+                             const char* n = nullptr,
+                             std::ostream* o = nullptr)
+        : dest((d && shouldSample(d)) ? d : nullptr),
+          start((dest) ? ProcessClock::now() : ProcessClock::time_point()),
+          name(n),
+          out(o) {
+    }
+
+    ~GenericSampledBlockTimer() {
+        if (dest) {
+            auto spent = ProcessClock::now() - start;
+            dest->add(std::chrono::duration_cast<std::chrono::microseconds>(
+                              spent),
+                      SAMPLE_RATE);
+            GenericBlockTimer<HISTOGRAM, THRESHOLD_MS>::log(spent, name, out);
+        }
+    }
+
+private:
+    /**
+     * Should the current execution recording into the given histogram be
+     * timed? The first execution for each histogram on each thread is
+     * timed, and then every SAMPLE_RATE execution.
+     *
+     * The countdowns are kept in a small direct mapped table per thread.
+     * If another histogram maps to the same entry, the entry is taken over
+     * with the countdown starting at a random position so every execution
+     * is still timed with a probability of 1 / SAMPLE_RATE (and the scaled
+     * counts stay unbiased).
+     */
+    static bool shouldSample(const HISTOGRAM* d) {
+        struct Countdown {
+            const HISTOGRAM* dest;
+            uint64_t remaining;
+        };
+        static thread_local std::array<Countdown, 1 << CountdownBits>
+                countdowns;
+
+        auto& countdown = countdowns[(uint64_t(uintptr_t(d)) *
+                                      0x9e3779b97f4a7c15ULL) >>
+                                     (64 - CountdownBits)];
+        if (countdown.dest != d) {
+            countdown.remaining =
+                    countdown.dest == nullptr ? 0 : random() % SAMPLE_RATE;
+            countdown.dest = d;
+        }
+        if (countdown.remaining == 0) {
+            countdown.remaining = SAMPLE_RATE - 1;
+            return true;
+        }
+        --countdown.remaining;
+        return false;
+    }
+
+    /// A per thread xorshift generator
+    static uint64_t random() {
+        static thread_local uint64_t state = 0x9e3779b97f4a7c15ULL;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    /// log2 of the number of countdowns kept per thread
+    static const int CountdownBits = 4;
+
+    HISTOGRAM* dest;
+    ProcessClock::time_point start;
+    const char* name;
+    std::ostream* out;
+};
+
+/* Convenience alias which only records in a MicrosecondHistogram;
+ * doesn't log slow blocks.
+ */
+template <uint64_t SAMPLE_RATE>
+using SampledBlockTimer =
+        GenericSampledBlockTimer<MicrosecondHistogram, SAMPLE_RATE>;
+
 // How to print a bin.
 template <typename T, template <class> class Limits>
 std::ostream& operator<<(std::ostream& out, const HistogramBin<T, Limits>& b) {
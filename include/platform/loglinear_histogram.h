@@ -0,0 +1,440 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/histogram.h>
+#include <platform/platform.h>
+#include <platform/sized_buffer.h>
+#include <relaxed_atomic.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace cb {
+
+/**
+ * The bucket layout used by the LogLinearHistogram (the same layout as
+ * used by HdrHistogram).
+ *
+ * The value range is split into buckets covering [2^n, 2^(n+1)), and
+ * each bucket is split into sub-buckets of equal width. The number of
+ * sub-buckets is picked so that the width of a sub-bucket is never
+ * bigger than value / 10^significantDigits (all values recorded in a
+ * sub-bucket are within the requested precision). The index of the
+ * sub-bucket serving a value is calculated with a count leading zeros
+ * and a couple of shifts.
+ *
+ * Values above the highest trackable value are counted in the last
+ * sub-bucket.
+ */
+class PLATFORM_PUBLIC_API LogLinearLayout {
+public:
+    /**
+     * Create a new layout
+     *
+     * @param highestTrackableValue the highest value to track with the
+     *                              requested precision (must be >= 2)
+     * @param significantDigits the number of significant decimal digits
+     *                          to keep (1 - 5)
+     * @throws std::invalid_argument for an invalid configuration
+     */
+    LogLinearLayout(uint64_t highestTrackableValue, int significantDigits);
+
+    /**
+     * Get the number of sub-buckets (counters) in the layout
+     */
+    size_t size() const {
+        return countsLength;
+    }
+
+    /**
+     * Get the index of the sub-bucket counting the given value
+     */
+    size_t indexOf(uint64_t value) const {
+        const int pow2ceiling = 64 - countLeadingZeros(value | subBucketMask);
+        const int bucketIndex = pow2ceiling - (subBucketHalfCountMagnitude + 1);
+        const size_t subBucketIndex = size_t(value >> bucketIndex);
+        const size_t index =
+                (size_t(bucketIndex + 1) << subBucketHalfCountMagnitude) +
+                subBucketIndex - subBucketHalfCount;
+        return index < countsLength ? index : countsLength - 1;
+    }
+
+    /**
+     * Get the lowest value counted in the given sub-bucket
+     */
+    uint64_t lowestEquivalentValue(size_t index) const;
+
+    /**
+     * Get the lowest value _not_ counted in the given sub-bucket (if it
+     * is representable; the end of the last possible sub-bucket
+     * saturates at the max value of uint64_t)
+     */
+    uint64_t nextNonEquivalentValue(size_t index) const;
+
+    uint64_t getHighestTrackableValue() const {
+        return highestTrackableValue;
+    }
+
+    int getSignificantDigits() const {
+        return significantDigits;
+    }
+
+    bool operator==(const LogLinearLayout& other) const {
+        return highestTrackableValue == other.highestTrackableValue &&
+               significantDigits == other.significantDigits;
+    }
+
+    bool operator!=(const LogLinearLayout& other) const {
+        return !(*this == other);
+    }
+
+protected:
+    static int countLeadingZeros(uint64_t value) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return 63 - int(index);
+#else
+        return __builtin_clzll(value);
+#endif
+    }
+
+    uint64_t highestTrackableValue;
+    int significantDigits;
+    int subBucketHalfCountMagnitude;
+    size_t subBucketHalfCount;
+    uint64_t subBucketMask;
+    size_t countsLength;
+};
+
+/**
+ * A Histogram with log-linear bins (see LogLinearLayout) where the
+ * counters live in a single contiguous array.
+ *
+ * Unlike Histogram<T> (which does a binary search over the bins, each
+ * allocated separately) the bin to update is computed directly from the
+ * value, so add() is O(1) and touches a single cache line.
+ *
+ * The histogram provides the same begin() / end() iteration as
+ * Histogram<T>; dereferencing the iterator returns an object with
+ * start(), end() and count() which may also be used with ->, so code
+ * written like:
+ *
+ *     for (const auto& bin : histogram) {
+ *         out << bin->start() << " " << bin->count();
+ *     }
+ *
+ * works with both kinds of histograms.
+ *
+ * The histogram tracks non-negative values only.
+ *
+ * Note: the non-trivial methods are defined in loglinear_histogram.cc. If
+ * you want to add a new instantiation of this class; check the explicit
+ * template definition in loglinear_histogram.cc.
+ */
+template <typename T, template <class> class Limits = std::numeric_limits>
+class LogLinearHistogram {
+public:
+    /**
+     * A view of a single bin in the histogram
+     */
+    class Bin {
+    public:
+        Bin(const LogLinearHistogram& h, size_t i) : histogram(&h), index(i) {
+        }
+
+        /**
+         * The starting value of this histogram bin (inclusive).
+         */
+        T start() const {
+            return histogram->fromRaw(
+                    histogram->layout.lowestEquivalentValue(index));
+        }
+
+        /**
+         * The ending value of this histogram bin (exclusive). The last bin
+         * reaches to the largest possible value.
+         */
+        T end() const {
+            if (index == histogram->layout.size() - 1) {
+                return Limits<T>::max();
+            }
+            return histogram->fromRaw(
+                    histogram->layout.nextNonEquivalentValue(index));
+        }
+
+        /**
+         * The count in this bin.
+         */
+        size_t count() const {
+            return histogram->counts[index].load();
+        }
+
+        // Allow the bin to be used like the unique_ptr<HistogramBin> the
+        // iterator of Histogram<T> returns
+        const Bin* operator->() const {
+            return this;
+        }
+
+        const Bin& operator*() const {
+            return *this;
+        }
+
+        // How to print a bin (durations are printed as their count)
+        friend std::ostream& operator<<(std::ostream& out, const Bin& b) {
+            out << "[" << toRaw(b.start()) << ", " << toRaw(b.end())
+                << ") = " << b.count();
+            return out;
+        }
+
+    private:
+        const LogLinearHistogram* histogram;
+        size_t index;
+    };
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Bin;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Bin*;
+        using reference = Bin;
+
+        const_iterator(const LogLinearHistogram& h, size_t i)
+            : histogram(&h), index(i) {
+        }
+
+        Bin operator*() const {
+            return Bin(*histogram, index);
+        }
+
+        const_iterator& operator++() {
+            ++index;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto ret = *this;
+            ++index;
+            return ret;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return index == other.index && histogram == other.histogram;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        const LogLinearHistogram* histogram;
+        size_t index;
+    };
+
+    using bin_type = Bin;
+    using value_type = Bin;
+    using iterator = const_iterator;
+
+    /**
+     * Build a histogram.
+     *
+     * The number of bins (and the memory used) grows with the number
+     * of significant digits and the highest trackable value; a
+     * histogram with 2 significant digits needs 128 counters for every
+     * power of two above 256.
+     *
+     * @param highestTrackableValue the highest value to track with the
+     *                              requested precision (larger values
+     *                              are counted in the last bin)
+     * @param significantDigits the number of significant decimal digits
+     *                          to keep (1 - 5)
+     * @throws std::invalid_argument for an invalid configuration
+     */
+    explicit LogLinearHistogram(T highestTrackableValue = Limits<T>::max(),
+                                int significantDigits = 2);
+
+    LogLinearHistogram(const LogLinearHistogram& other) = delete;
+    LogLinearHistogram(LogLinearHistogram&& other) = default;
+    LogLinearHistogram& operator=(const LogLinearHistogram& other) = delete;
+    LogLinearHistogram& operator=(LogLinearHistogram&& other) = default;
+
+    /**
+     * Add a value to this histogram.
+     *
+     * @param amount the size of the thing being added
+     * @param count the quantity at this size being added
+     */
+    void add(T amount, size_t count = 1) {
+        counts[layout.indexOf(toRaw(amount))].fetch_add(count);
+    }
+
+    /**
+     * Add a batch of values to this histogram.
+     *
+     * The bin indexes are computed for a block of values at a time and
+     * counted locally so that only one atomic add is done for each bin
+     * hit by the block (instead of one per value).
+     *
+     * @param values the values to add
+     */
+    void add(cb::sized_buffer<const T> values);
+
+    /**
+     * Get the bin servicing the given sized input.
+     */
+    Bin getBin(T amount) const {
+        return Bin(*this, layout.indexOf(toRaw(amount)));
+    }
+
+    /**
+     * Set all bins to 0.
+     */
+    void reset();
+
+    /**
+     * Get the value at the given percentile (interpolated within the bin
+     * containing it). See cb::getHistogramPercentile.
+     *
+     * @param percentile the requested percentile [0, 100]
+     * @throws std::invalid_argument if percentile is outside [0, 100]
+     */
+    T percentile(double percentile) const;
+
+    /**
+     * Add the counts from another histogram to this histogram.
+     *
+     * @param other the histogram to add the counts from
+     * @throws std::invalid_argument if the histograms have different layouts
+     */
+    void merge(const LogLinearHistogram& other);
+
+    /**
+     * Get a copy of this histogram (see Histogram::snapshot)
+     */
+    LogLinearHistogram snapshot() const;
+
+    /**
+     * Get a copy of this histogram and atomically reset each bin in this
+     * histogram (see Histogram::drain)
+     */
+    LogLinearHistogram drain();
+
+    /**
+     * Encode the histogram in a compact binary form (the layout
+     * parameters followed by the non-zero bins; see Histogram::encode)
+     */
+    std::vector<uint8_t> encode() const;
+
+    /**
+     * Decode a histogram encoded by encode()
+     *
+     * @param encoded the encoded histogram
+     * @throws std::invalid_argument if the input isn't a valid encoded
+     *                               histogram
+     */
+    static LogLinearHistogram decode(cb::const_byte_buffer encoded);
+
+    /**
+     * Get the total number of samples counted.
+     *
+     * This is the sum of all counts in each bin.
+     */
+    size_t total() const;
+
+    /**
+     * Get the layout of the bins
+     */
+    const LogLinearLayout& getLayout() const {
+        return layout;
+    }
+
+    /**
+     * Get the number of bins in the histogram
+     */
+    size_t size() const {
+        return layout.size();
+    }
+
+    /**
+     * Convert a value to the raw value used by the layout
+     */
+    static uint64_t toRaw(T value) {
+        // Dividing two durations returns a value of the underlying Rep.
+        return uint64_t(value / T(1));
+    }
+
+    /**
+     * Convert a raw value used by the layout back to T (saturating at
+     * the max value of T)
+     */
+    static T fromRaw(uint64_t value) {
+        const uint64_t max = toRaw(Limits<T>::max());
+        return T(value < max ? value : max);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(*this, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(*this, layout.size());
+    }
+
+private:
+    LogLinearLayout layout;
+    std::unique_ptr<Couchbase::RelaxedAtomic<size_t>[]> counts;
+};
+
+/**
+ * LogLinearHistogram of durations measured in microseconds.
+ */
+using MicrosecondLogLinearHistogram =
+        LogLinearHistogram<UnsignedMicroseconds, cb::duration_limits>;
+
+// How to print a histogram (only the bins with a non-zero count is
+// printed as the histogram typically contains hundreds of bins).
+template <typename T, template <class> class Limits>
+std::ostream& operator<<(std::ostream& out,
+                         const LogLinearHistogram<T, Limits>& h) {
+    out << "{LogLinearHistogram: ";
+    bool needComma(false);
+    for (const auto& bin : h) {
+        if (bin.count() == 0) {
+            continue;
+        }
+        if (needComma) {
+            out << ", ";
+        }
+        out << bin;
+        needComma = true;
+    }
+    out << "}";
+    return out;
+}
+
+} // namespace cb
@@ -0,0 +1,75 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cb {
+/**
+ * A MirroredMemory is a memory segment where the same physical pages
+ * are mapped twice, back to back, in the virtual address space. Writing
+ * to data()[n] is visible at data()[n + size()] (and vice versa).
+ *
+ * This allows a ring buffer of size() bytes to always present the
+ * data between the read and write position as a single contiguous
+ * area of memory (even when it wraps around the end of the buffer),
+ * as long as the read position is kept below size().
+ */
+class PLATFORM_PUBLIC_API MirroredMemory {
+public:
+    /**
+     * Create a new mirrored segment.
+     *
+     * @param size the requested size of the segment. It is rounded up
+     *             to the allocation granularity of the system (the page
+     *             size)
+     * @throws std::system_error if the operating system fails to create
+     *                           the mapping
+     */
+    explicit MirroredMemory(size_t size);
+
+    ~MirroredMemory();
+
+    MirroredMemory(const MirroredMemory&) = delete;
+    MirroredMemory& operator=(const MirroredMemory&) = delete;
+
+    /**
+     * Get the address of the first mapping. The area is 2 * size() bytes
+     * long.
+     */
+    uint8_t* data() const {
+        return root;
+    }
+
+    /**
+     * Get the size of the segment (the size of one of the mappings)
+     */
+    size_t size() const {
+        return length;
+    }
+
+private:
+    uint8_t* root;
+    size_t length;
+#ifdef WIN32
+    HANDLE maphandle;
+#endif
+};
+}
@@ -0,0 +1,72 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cb {
+/**
+ * A NumaMemory is a memory segment where the pages are allocated on the
+ * given NUMA node (see cb::get_numa_node()), so that data used by the
+ * CPUs of a node doesn't have to cross the interconnect between the
+ * sockets.
+ *
+ * Placing the pages is best effort: on systems without NUMA support (or
+ * if the node isn't available to the process) the pages are allocated
+ * like any other memory.
+ */
+class PLATFORM_PUBLIC_API NumaMemory {
+public:
+    /**
+     * Create a new segment.
+     *
+     * @param size the requested size of the segment. It is rounded up
+     *             to the allocation granularity of the system (the page
+     *             size)
+     * @param node the NUMA node to allocate the pages on
+     * @throws std::system_error if the operating system fails to allocate
+     *                           the memory
+     */
+    NumaMemory(size_t size, size_t node);
+
+    ~NumaMemory();
+
+    NumaMemory(const NumaMemory&) = delete;
+    NumaMemory& operator=(const NumaMemory&) = delete;
+
+    /**
+     * Get the address of the segment (aligned to the page size)
+     */
+    uint8_t* data() const {
+        return root;
+    }
+
+    /**
+     * Get the size of the segment
+     */
+    size_t size() const {
+        return length;
+    }
+
+private:
+    uint8_t* root;
+    size_t length;
+};
+}
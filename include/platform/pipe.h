@@ -18,15 +18,22 @@
 
 #include <cJSON_utils.h>
 #include <platform/cb_malloc.h>
+#include <platform/make_unique.h>
+#include <platform/mirrored_memory.h>
+#include <platform/pipe_buffer_pool.h>
+#include <platform/pipe_statistics.h>
 #include <platform/platform.h>
+#include <platform/processclock.h>
 #include <platform/sized_buffer.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cinttypes>
 #include <cstdint>
 #include <functional>
 #include <memory>
 #include <stdexcept>
+#include <vector>
 
 namespace cb {
 
@@ -80,9 +87,80 @@ namespace cb {
  * the read_head, and once consumed the read head is moved forward. Whenever
  * the read_head catch up with the write_head they're both set to 0 (the
  * beginning of the buffer).
+ *
+ * Mirrored backing:
+ *
+ * The pipe may optionally be backed by a cb::MirroredMemory segment
+ * (the same pages mapped twice back to back). In this mode the buffer is
+ * used as a ring buffer: the write_head may move past the end of the
+ * first mapping (into the mirror), and once the read_head moves past the
+ * end of the first mapping both heads are moved back by the size of the
+ * buffer. The data between the read_head and the write_head (and the free
+ * space after the write_head) is always contiguous, so pack() never
+ * needs to move any data. ensureCapacity still needs to allocate (and
+ * copy the data to) a bigger segment if the pipe doesn't have enough free
+ * space, so this mode is best suited for fixed size pipes.
+ *
+ * Buffer reclamation:
+ *
+ * The linear buffers are allocated from (and returned to) the process-wide
+ * cb::PipeBufferPool. A pipe may be configured to release its buffer
+ * when it has been idle for a while (see setShrinkPolicy) to avoid
+ * keeping the high-water-mark allocation for mostly idle connections.
+ * A released pipe has a capacity of 0; the buffer is reacquired (with
+ * the initial size) by ensureCapacity() and produce().
+ *
+ * Header reservation:
+ *
+ * The producer may reserve a gap at the write head (see reserve()) for a
+ * protocol header which isn't known until the body following it has been
+ * produced. The gap and everything produced after it is hidden from the
+ * consumer until the header is written into the end of the gap (see
+ * hdata() and prepended() or prepend()), so the header and the body is
+ * available as one contiguous rdata() segment (after any data produced
+ * before the reservation) without moving the body.
+ *
+ * Statistics:
+ *
+ * A pipe may count the number of produce / consume calls, the number of
+ * times the buffer was packed or reallocated, the number of bytes moved
+ * by doing so and the peak capacity of the buffer (see getStatistics()).
+ * The counters are disabled by default (see setStatisticsEnabled()) to
+ * keep the produce / consume calls free from the extra stores. The
+ * counters for packing and reallocation is also added to the process
+ * wide cb::PipeStatistics (unless disabled there).
  */
 class Pipe {
 public:
+    /**
+     * The counters kept by the pipe
+     */
+    struct Statistics {
+        /// The number of calls to produce()
+        size_t produce_calls = 0;
+        /// The number of calls to consume() and consumeFrames()
+        size_t consume_calls = 0;
+        /// The number of times data was moved to the beginning of the buffer
+        size_t packs = 0;
+        /// The number of bytes moved by packing or reallocating the buffer
+        size_t bytes_moved = 0;
+        /// The number of times the data was moved to a bigger buffer
+        size_t reallocs = 0;
+        /// The biggest capacity the pipe had
+        size_t peak_capacity = 0;
+    };
+
+    /**
+     * The kind of memory backing the pipe
+     */
+    enum class Backing {
+        /// A linear buffer allocated from the cb::PipeBufferPool
+        Linear,
+        /// A cb::MirroredMemory segment (the size is rounded up to
+        /// the page size)
+        Mirrored
+    };
+
     /**
      * Initialize a pipe with the given buffer size (default empty).
      *
@@ -95,13 +173,123 @@ public:
      *
      * @param size The initial size of the buffer in the pipe (default 2k)
      */
-    explicit Pipe(size_t size = 2048) {
-        const size_t allocation_size = std::max(size, size_t(128));
-        memory.reset(static_cast<uint8_t*>(cb_malloc(allocation_size)));
-        if (!memory) {
-            throw std::bad_alloc();
+    explicit Pipe(size_t size = 2048) : Pipe(size, Backing::Linear) {
+    }
+
+    /**
+     * Initialize a pipe with the given buffer size and backing.
+     *
+     * @param size The initial size of the buffer in the pipe
+     * @param backing The kind of memory to use for the buffer
+     * @throws std::bad_alloc if memory allocation fails
+     * @throws std::system_error if we fail to create the mirrored mapping
+     */
+    Pipe(size_t size, Backing backing)
+        : initial_size(size), backing(backing) {
+        allocateBuffer(size);
+    }
+
+    /**
+     * Set the policy for when the pipe should release its buffer.
+     *
+     * @param consumes release the buffer when consume() has been called
+     *                 this many times without finding any data in the
+     *                 pipe (0 to disable)
+     * @param idle release the buffer when releaseIfIdle() finds that the
+     *             pipe has been empty for (at least) this long (0 to
+     *             disable)
+     */
+    void setShrinkPolicy(size_t consumes, std::chrono::milliseconds idle) {
+        shrink_after_consumes = consumes;
+        shrink_after_idle = idle;
+        idle_consumes = 0;
+        idle_since = {};
+    }
+
+    /**
+     * Check if the pipe has been idle for longer than the configured
+     * idle time, and if so release the buffer. This method is intended
+     * to be called periodically (for instance from the idle timer of a
+     * connection); the pipe starts counting its idle time the first time
+     * it is found empty.
+     *
+     * @param now the current time
+     * @return true if the buffer is released
+     */
+    bool releaseIfIdle(ProcessClock::time_point now = ProcessClock::now()) {
+        if (shrink_after_idle.count() == 0 || !empty()) {
+            idle_since = {};
+            return isReleased();
+        }
+
+        if (idle_since == ProcessClock::time_point{}) {
+            idle_since = now;
+        } else if (now - idle_since >= shrink_after_idle) {
+            releaseBuffer();
+        }
+        return isReleased();
+    }
+
+    /**
+     * Release the underlying buffer if the pipe is empty
+     *
+     * @return true if the buffer is released
+     */
+    bool releaseBuffer() {
+        if (!empty()) {
+            return false;
+        }
+        memory.reset();
+        mirror.reset();
+        buffer = {};
+        released = true;
+        resetHeads();
+        idle_consumes = 0;
+        idle_since = {};
+        return true;
+    }
+
+    /**
+     * Is the underlying buffer released?
+     */
+    bool isReleased() const {
+        return released;
+    }
+
+    /**
+     * Reserve a gap of the given number of bytes at the write head for a
+     * header to be written once the data following it has been produced.
+     *
+     * The data produced before the reservation is still available for the
+     * consumer, but the gap and everything produced after it isn't made
+     * available until the header is written into the gap (see hdata(),
+     * prepended() and prepend()). Only one reservation may be outstanding
+     * at the time.
+     *
+     * This method might reallocate the buffer and invalidate all pointers
+     * into the buffer.
+     *
+     * @param nbytes the number of bytes to reserve
+     * @return the reserved gap
+     * @throws std::invalid_argument if nbytes is 0
+     * @throws std::logic_error if there is an outstanding reservation
+     * @throws std::bad_alloc if memory allocation fails
+     */
+    cb::byte_buffer reserve(size_t nbytes) {
+        if (nbytes == 0) {
+            throw std::invalid_argument(
+                    "Pipe::reserve(): nbytes must be non-zero");
+        }
+        if (reserved != 0) {
+            throw std::logic_error(
+                    "Pipe::reserve(): There is already a reservation in the "
+                    "pipe");
         }
-        buffer = {memory.get(), size};
+        ensureCapacity(nbytes);
+        reserved_at = write_head;
+        reserved = nbytes;
+        produced(nbytes);
+        return hdata();
     }
 
     /**
@@ -117,7 +305,11 @@ public:
      * @throws std::bad_alloc if memory allocation fails
      */
     size_t ensureCapacity(size_t nbytes) {
-        const size_t tail_space = buffer.size() - write_head;
+        if (isReleased()) {
+            allocateBuffer(initial_size);
+        }
+
+        const size_t tail_space = wsize();
         if (tail_space >= nbytes) {
             // There is enough space available at the tail
             return wsize();
@@ -128,30 +320,41 @@ public:
         // We don't want to allocate buffers of all kinds of sizes, so just
         // keep on doubling the size of the buffer until we find a buffer
         // which is big enough.
-        const size_t needed = nbytes + rsize();
+        const size_t needed = nbytes + write_head - read_head;
         size_t nsize = buffer.size();
         while (needed > nsize) {
             nsize *= 2;
         }
 
-        if (nsize != buffer.size()) {
-            // We need to reallocate in order to satisfy the allocation
-            // request.
-            auto* newm = cb_realloc(memory.get(), nsize);
-            if (newm == nullptr) {
-                throw std::bad_alloc();
-            }
+        if (mirror) {
+            // The free space in a mirrored buffer is always contiguous,
+            // so we need a bigger mapping. Copy the data to the
+            // beginning of the new mapping.
+            auto next = std::make_unique<cb::MirroredMemory>(nsize);
+            std::copy(buffer.data() + read_head,
+                      buffer.data() + write_head,
+                      next->data());
+            recordRealloc(write_head - read_head, next->size());
+            rebaseHeads();
+            mirror = std::move(next);
+            buffer = {mirror->data(), mirror->size()};
+            return wsize();
+        }
 
-            // We're using a std::unique_ptr to keep track of the allocated
-            // memory segment, but realloc may or may not perform a
-            // reallocation. If it did perform a reallocation it released
-            // the allocated memory, so we need to release that from our
-            // unique_ptr to avoid unique_ptr to free the memory when
-            // we try to reset the new memory (if not we'll try to free
-            // the memory twice).
-            memory.release();
-            memory.reset(static_cast<uint8_t*>(newm));
+        if (nsize != buffer.size()) {
+            // We need a bigger buffer in order to satisfy the allocation
+            // request. Fetch one from the pool and copy the data to the
+            // beginning of it (so we don't need to pack it afterwards).
+            pool_buffer next(cb::PipeBufferPool::instance().allocate(nsize),
+                             pool_deleter{nsize});
+            std::copy(buffer.data() + read_head,
+                      buffer.data() + write_head,
+                      next.get());
+            recordRealloc(write_head - read_head, nsize);
+            rebaseHeads();
+            memory = std::move(next);
             buffer = {memory.get(), nsize};
+            return wsize();
         }
 
         // Pack the buffer by moving all of the data to the beginning of
@@ -198,6 +401,83 @@ public:
         return getAvailableWriteSpace();
     }
 
+    /**
+     * Get the number of bytes in the outstanding reservation (0 if there
+     * isn't any)
+     */
+    size_t hsize() const {
+        return reserved;
+    }
+
+    /**
+     * Get the gap reserved by reserve(). The header should be written to
+     * the _end_ of this segment, and then made available by calling
+     * prepended().
+     */
+    cb::byte_buffer hdata() const {
+        return {const_cast<uint8_t*>(buffer.data()) + reserved_at, reserved};
+    }
+
+    /**
+     * A header of the given number of bytes was written to the end of the
+     * reserved gap (see hdata()). The header and the data produced after
+     * it is made available for the consumer.
+     *
+     * If the header is smaller than the gap, the data produced before the
+     * reservation (if any) is moved forward to close the gap. The data
+     * produced after the reservation is never moved.
+     *
+     * @param nbytes the number of bytes prepended
+     * @throws std::logic_error if there isn't any reservation or nbytes
+     *                          exceeds the size of the reservation
+     */
+    void prepended(size_t nbytes) {
+        if (reserved == 0) {
+            throw std::logic_error(
+                    "Pipe::prepended(): There is no reservation in the pipe");
+        }
+        if (nbytes > reserved) {
+            throw std::logic_error(
+                    "Pipe::prepended(): Prepended bytes exceeds "
+                    "the size of the reservation");
+        }
+
+        const size_t unused = reserved - nbytes;
+        const size_t before = reserved_at - read_head;
+        if (unused != 0 && before != 0) {
+            ::memmove(buffer.data() + read_head + unused,
+                      buffer.data() + read_head,
+                      before);
+            if (collect_statistics) {
+                statistics.bytes_moved += before;
+            }
+        }
+        read_head += unused;
+        reserved = 0;
+        if (mirror && read_head >= buffer.size()) {
+            // Move both heads back into the first mapping
+            read_head -= buffer.size();
+            write_head -= buffer.size();
+        }
+    }
+
+    /**
+     * Copy the provided header to the end of the reserved gap and make it
+     * available for the consumer (see prepended())
+     *
+     * @param data the data to prepend
+     * @throws std::logic_error if there isn't any reservation or the data
+     *                          doesn't fit in the reservation
+     */
+    void prepend(cb::const_byte_buffer data) {
+        if (data.size() > reserved) {
+            throw std::logic_error(
+                    "Pipe::prepend(): Not enough reserved space in the pipe");
+        }
+        std::copy(data.begin(), data.end(), hdata().end() - data.size());
+        prepended(data.size());
+    }
+
     /**
      * Try to produce a number of bytes by providing a callback function
      * which will receive the buffer where the data may be inserted
@@ -209,6 +489,23 @@ public:
      */
     ssize_t produce(std::function<ssize_t(void* /* ptr */, size_t /* size */)>
                             producer) {
+        return produce<decltype(producer)&>(producer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Producer>
+    auto produce(Producer&& producer) -> decltype(
+            ssize_t(producer(static_cast<void*>(nullptr), size_t(0)))) {
+        if (collect_statistics) {
+            ++statistics.produce_calls;
+        }
+        if (isReleased()) {
+            allocateBuffer(initial_size);
+        }
         auto avail = getAvailableWriteSpace();
 
         const ssize_t ret =
@@ -230,6 +527,23 @@ public:
      * @return the number of bytes produced
      */
     ssize_t produce(std::function<ssize_t(cb::byte_buffer)> producer) {
+        return produce<decltype(producer)&>(producer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Producer>
+    auto produce(Producer&& producer)
+            -> decltype(ssize_t(producer(cb::byte_buffer{}))) {
+        if (collect_statistics) {
+            ++statistics.produce_calls;
+        }
+        if (isReleased()) {
+            allocateBuffer(initial_size);
+        }
         auto avail = getAvailableWriteSpace();
 
         const ssize_t ret = producer({avail.data(), avail.size()});
@@ -245,12 +559,14 @@ public:
      * A number of bytes was made available for the consumer
      */
     void produced(size_t nbytes) {
-        if (write_head + nbytes > buffer.size()) {
+        if (nbytes > getAvailableWriteSpace().size()) {
             throw std::logic_error(
                     "Pipe::produced(): Produced bytes exceeds "
                     "the number of available bytes");
         }
         write_head += nbytes;
+        idle_consumes = 0;
+        idle_since = {};
     }
 
     /**
@@ -263,12 +579,28 @@ public:
      */
     ssize_t consume(std::function<ssize_t(const void* /* ptr */,
                                           size_t /* size */)> consumer) {
+        return consume<decltype(consumer)&>(consumer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Consumer>
+    auto consume(Consumer&& consumer)
+            -> decltype(ssize_t(consumer(static_cast<const void*>(nullptr),
+                                         size_t(0)))) {
+        if (collect_statistics) {
+            ++statistics.consume_calls;
+        }
         auto avail = getAvailableReadSpace();
         const ssize_t ret =
                 consumer(static_cast<const void*>(avail.data()), avail.size());
         if (ret > 0) {
             consumed(ret);
         }
+        maybeShrink();
         return ret;
     }
 
@@ -281,14 +613,99 @@ public:
      * @return the number of bytes consumed
      */
     ssize_t consume(std::function<ssize_t(cb::const_byte_buffer)> consumer) {
+        return consume<decltype(consumer)&>(consumer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Consumer>
+    auto consume(Consumer&& consumer)
+            -> decltype(ssize_t(consumer(cb::const_byte_buffer{}))) {
+        if (collect_statistics) {
+            ++statistics.consume_calls;
+        }
         auto avail = getAvailableReadSpace();
         const ssize_t ret = consumer({avail.data(), avail.size()});
         if (ret > 0) {
             consumed(ret);
         }
+        maybeShrink();
         return ret;
     }
 
+    /**
+     * Consume all of the complete length-prefixed frames available in the
+     * read end of the pipe.
+     *
+     * A frame consists of a fixed size header followed by a body where the
+     * length of the body is encoded in the header. The frames are collected
+     * (without copying the data) and passed to the callback as one batch,
+     * and all of the frames are consumed once the callback returns. Any
+     * trailing partial frame is left in the pipe.
+     *
+     * The callback must not modify the pipe (the frames point into the
+     * buffer).
+     *
+     *     pipe.consumeFrames(
+     *         sizeof(Header),
+     *         [](cb::const_byte_buffer header) -> size_t {
+     *             return getBodyLength(header);
+     *         },
+     *         [](cb::sized_buffer<const cb::const_byte_buffer> frames) {
+     *             for (const auto& frame : frames) {
+     *                 // process the frame (header and body)
+     *             }
+     *         });
+     *
+     * @param headerSize the number of bytes in the frame header
+     * @param bodyLength a callback which receives the header of a frame and
+     *                   returns the number of bytes in the body
+     * @param callback a callback which receives all of the complete frames
+     *                 (it is not called if there are no complete frames)
+     * @return the number of frames consumed
+     * @throws std::invalid_argument if headerSize is 0
+     */
+    template <typename LengthExtractor, typename FrameCallback>
+    size_t consumeFrames(size_t headerSize,
+                         LengthExtractor&& bodyLength,
+                         FrameCallback&& callback) {
+        if (headerSize == 0) {
+            throw std::invalid_argument(
+                    "Pipe::consumeFrames(): headerSize must be non-zero");
+        }
+
+        if (collect_statistics) {
+            ++statistics.consume_calls;
+        }
+        frames.clear();
+        const auto avail = getAvailableReadSpace();
+        size_t offset = 0;
+        while (avail.size() - offset >= headerSize) {
+            const size_t length =
+                    bodyLength(cb::const_byte_buffer{avail.data() + offset,
+                                                     headerSize});
+            const size_t remaining = avail.size() - offset - headerSize;
+            if (length > remaining) {
+                break;
+            }
+            frames.emplace_back(avail.data() + offset, headerSize + length);
+            offset += headerSize + length;
+        }
+
+        if (frames.empty()) {
+            return 0;
+        }
+
+        callback(cb::sized_buffer<const cb::const_byte_buffer>{
+                frames.data(), frames.size()});
+        consumed(offset);
+        maybeShrink();
+        return frames.size();
+    }
+
     /**
      * The number of bytes just removed from the consumer end of the buffer.
      *
@@ -297,7 +714,7 @@ public:
      * buffer)
      */
     void consumed(size_t nbytes) {
-        if (read_head + nbytes > write_head) {
+        if (nbytes > rsize()) {
             throw std::logic_error(
                     "Pipe::consumed(): Consumed bytes exceeds "
                     "the number of available bytes");
@@ -305,7 +722,14 @@ public:
 
         read_head += nbytes;
         if (empty()) {
-            read_head = write_head = 0;
+            resetHeads();
+        } else if (mirror && read_head >= buffer.size()) {
+            // Move both heads back into the first mapping
+            read_head -= buffer.size();
+            write_head -= buffer.size();
+            if (reserved != 0) {
+                reserved_at -= buffer.size();
+            }
         }
     }
 
@@ -318,20 +742,27 @@ public:
      * byte is at the end of the pipe.
      *
      * Packing the buffer moves all of the bytes in the pipe to the beginning
-     * of the internal buffer resulting in a larger available memory segment
-     * at the end.
+     * of the internal buffer resulting in a larger
+     * available memory segment at the end.
+     *
+     * A pipe using the mirrored backing never needs to be packed (all of
+     * the free space is always available after the write head).
      *
      * @return true if the buffer is empty after packing
      */
     bool pack() {
         if (read_head == write_head) {
-            read_head = write_head = 0;
-        } else if (read_head != 0) {
+            resetHeads();
+        } else if (read_head != 0 && !mirror) {
             ::memmove(buffer.data(),
                       buffer.data() + read_head,
                       write_head - read_head);
-            write_head -= read_head;
-            read_head = 0;
+            if (collect_statistics) {
+                ++statistics.packs;
+                statistics.bytes_moved += write_head - read_head;
+            }
+            cb::PipeStatistics::instance().packed(write_head - read_head);
+            rebaseHeads();
         }
 
         return empty();
@@ -349,18 +780,44 @@ public:
      * Is this buffer full or not
      */
     bool full() const {
-        return write_head == buffer.size();
+        return getAvailableWriteSpace().size() == 0;
     }
 
     /**
-     * Clear all of the content in the buffer
+     * Clear all of the content in the buffer (including any reservation)
      */
     void clear() {
-        write_head = read_head = 0;
+        resetHeads();
     }
 
     /**
-     * Get the (internal) properties of the pipe
+     * Enable (or disable) collecting the counters for this pipe (they're
+     * not collected by default). The process-wide cb::PipeStatistics is
+     * enabled separately.
+     */
+    void setStatisticsEnabled(bool enable) {
+        collect_statistics = enable;
+        if (enable) {
+            statistics.peak_capacity =
+                    std::max(statistics.peak_capacity, buffer.size());
+        }
+    }
+
+    bool isStatisticsEnabled() const {
+        return collect_statistics;
+    }
+
+    /**
+     * Get the counters for this pipe (see setStatisticsEnabled())
+     */
+    const Statistics& getStatistics() const {
+        return statistics;
+    }
+
+    /**
+     * Get the (internal) properties of the pipe. The counters for the pipe
+     * and the occupancy of the cb::PipeBufferPool is included when the
+     * statistics is enabled (see setStatisticsEnabled()).
      */
     unique_cJSON_ptr to_json() const {
         unique_cJSON_ptr ret(cJSON_CreateObject());
@@ -368,11 +825,101 @@ public:
         cJSON_AddNumberToObject(ret.get(), "size", buffer.size());
         cJSON_AddNumberToObject(ret.get(), "read_head", read_head);
         cJSON_AddNumberToObject(ret.get(), "write_head", write_head);
+        cJSON_AddNumberToObject(ret.get(), "reserved", reserved);
         cJSON_AddBoolToObject(ret.get(), "empty", empty());
+        cJSON_AddBoolToObject(ret.get(), "mirrored", bool(mirror));
+        cJSON_AddBoolToObject(ret.get(), "released", isReleased());
+        if (collect_statistics) {
+            cJSON* stats = cJSON_CreateObject();
+            cJSON_AddNumberToObject(
+                    stats, "produce_calls", statistics.produce_calls);
+            cJSON_AddNumberToObject(
+                    stats, "consume_calls", statistics.consume_calls);
+            cJSON_AddNumberToObject(stats, "packs", statistics.packs);
+            cJSON_AddNumberToObject(
+                    stats, "bytes_moved", statistics.bytes_moved);
+            cJSON_AddNumberToObject(stats, "reallocs", statistics.reallocs);
+            cJSON_AddNumberToObject(
+                    stats, "peak_capacity", statistics.peak_capacity);
+            cJSON_AddItemToObject(ret.get(), "stats", stats);
+            cJSON_AddItemToObject(
+                    ret.get(),
+                    "pool",
+                    cb::PipeBufferPool::instance().to_json().release());
+        }
         return ret;
     }
 
 protected:
+    /**
+     * Allocate a new buffer of the given size (for the configured backing).
+     * The size is at least 128 bytes.
+     */
+    void allocateBuffer(size_t size) {
+        const size_t allocation_size = std::max(size, size_t(128));
+        if (backing == Backing::Mirrored) {
+            mirror = std::make_unique<cb::MirroredMemory>(allocation_size);
+            buffer = {mirror->data(), mirror->size()};
+        } else {
+            memory = pool_buffer(
+                    cb::PipeBufferPool::instance().allocate(allocation_size),
+                    pool_deleter{allocation_size});
+            buffer = {memory.get(), allocation_size};
+        }
+        released = false;
+        resetHeads();
+        if (collect_statistics) {
+            statistics.peak_capacity =
+                    std::max(statistics.peak_capacity, buffer.size());
+        }
+        cb::PipeStatistics::instance().allocated(buffer.size());
+    }
+
+    /**
+     * Record that nbytes was copied into a new buffer of the given capacity
+     */
+    void recordRealloc(size_t nbytes, size_t capacity) {
+        if (collect_statistics) {
+            ++statistics.reallocs;
+            statistics.bytes_moved += nbytes;
+            statistics.peak_capacity =
+                    std::max(statistics.peak_capacity, capacity);
+        }
+        cb::PipeStatistics::instance().reallocated(nbytes, capacity);
+    }
+
+    /**
+     * Move the read and write head to the beginning of the buffer (and
+     * drop any reservation)
+     */
+    void resetHeads() {
+        read_head = write_head = 0;
+        reserved = 0;
+    }
+
+    /**
+     * Update the heads (and the reservation) after the data in the pipe
+     * was moved to the beginning of the buffer
+     */
+    void rebaseHeads() {
+        write_head -= read_head;
+        if (reserved != 0) {
+            reserved_at -= read_head;
+        }
+        read_head = 0;
+    }
+
+    /**
+     * Called after each consume() to check if the buffer should be
+     * released according to the shrink policy
+     */
+    void maybeShrink() {
+        if (shrink_after_consumes != 0 && empty() && !isReleased() &&
+            ++idle_consumes >= shrink_after_consumes) {
+            releaseBuffer();
+        }
+    }
+
     /**
      * Get information of the _unused_ space in the write end of
      * the pipe. This is a contiguous space the caller may use, and
@@ -380,8 +927,10 @@ protected:
      * should be available for the consumer in the read end of the pipe.
      */
     cb::byte_buffer getAvailableWriteSpace() const {
+        // In the mirrored mode the space in front of the read head is
+        // available after the write head (in the mirror)
         return {const_cast<uint8_t*>(buffer.data()) + write_head,
-                buffer.size() - write_head};
+                buffer.size() - write_head + (mirror ? read_head : 0)};
     }
 
     /**
@@ -391,24 +940,74 @@ protected:
      * available for the producer.
      */
     cb::const_byte_buffer getAvailableReadSpace() const {
-        return {buffer.data() + read_head, write_head - read_head};
+        // The data from the start of a reservation isn't available until
+        // the header is written into it
+        const size_t end = reserved != 0 ? reserved_at : write_head;
+        return {buffer.data() + read_head, end - read_head};
     }
 
     // The information about the underlying buffer
     cb::byte_buffer buffer;
 
-    struct cb_malloc_deleter {
+    // Set when the buffer is released (until it is reallocated)
+    bool released = false;
+
+    // Return the buffer to the pool it was allocated from
+    struct pool_deleter {
         void operator()(uint8_t* ptr) {
-            cb_free(static_cast<void*>(ptr));
+            cb::PipeBufferPool::instance().release(ptr, size);
         }
+        size_t size;
     };
-    std::unique_ptr<uint8_t, cb_malloc_deleter> memory;
+    using pool_buffer = std::unique_ptr<uint8_t, pool_deleter>;
+    pool_buffer memory{nullptr, pool_deleter{0}};
+
+    // The mirrored mapping used as the buffer (if the mirrored backing
+    // is used)
+    std::unique_ptr<cb::MirroredMemory> mirror;
 
     // The offset in the buffer where we may start write
     size_t write_head = 0;
 
     // The offset in the buffer where we may start deading
     size_t read_head = 0;
+
+    // The counters for this pipe
+    Statistics statistics;
+
+    // Should the counters for this pipe be updated
+    bool collect_statistics = false;
+
+    // The frames found by consumeFrames() (kept to avoid reallocating the
+    // vector for every batch)
+    std::vector<cb::const_byte_buffer> frames;
+
+    // The offset in the buffer of the gap reserved for a header
+    size_t reserved_at = 0;
+
+    // The number of bytes in the gap reserved for a header (0 == no
+    // reservation)
+    size_t reserved = 0;
+
+    // The size of the buffer to allocate if the buffer is released
+    size_t initial_size;
+
+    // The kind of memory backing the pipe
+    Backing backing;
+
+    // Release the buffer after this many consume() calls on an empty
+    // pipe (0 == disabled)
+    size_t shrink_after_consumes = 0;
+
+    // Release the buffer when releaseIfIdle() finds the pipe being empty
+    // for this long (0 == disabled)
+    std::chrono::milliseconds shrink_after_idle{0};
+
+    // The number of consume() calls since the pipe became empty
+    size_t idle_consumes = 0;
+
+    // The first time releaseIfIdle() found the pipe empty
+    ProcessClock::time_point idle_since;
 };
 
 } // namespace cb
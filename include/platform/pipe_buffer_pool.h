@@ -0,0 +1,169 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cJSON_utils.h>
+#include <platform/platform.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace cb {
+
+/**
+ * The PipeBufferPool is a process-wide pool of buffers used by cb::Pipe.
+ *
+ * The buffers are bucketed in size classes (powers of two from MinSize
+ * to MaxSize). A request for a buffer is served from the size class
+ * which fits the requested size:
+ *
+ *    * from the calling threads cache for the size class
+ *    * from the global list for the size class
+ *    * by allocating a new buffer with cb_malloc
+ *
+ * Released buffers are put back in the calling threads cache (for the
+ * size classes up to ThreadCacheMaxSize), and when that is full they're
+ * moved to the global list. Once the global lists hold more than the
+ * configured limit, released buffers are freed instead.
+ * Requests for more than MaxSize bytes are passed directly to
+ * cb_malloc / cb_free.
+ */
+class PLATFORM_PUBLIC_API PipeBufferPool {
+public:
+    /// The smallest size class in the pool
+    static const size_t MinSize = 128;
+    /// The biggest size class in the pool
+    static const size_t MaxSize = 1024 * 1024;
+    /// The number of size classes in the pool
+    static const size_t NumSizeClasses = 14;
+    /// The number of buffers in each size class a thread may cache
+    static const size_t ThreadCacheSize = 4;
+    /// The biggest size class cached by the threads
+    static const size_t ThreadCacheMaxSize = 64 * 1024;
+
+    /**
+     * Get the process-wide instance of the pool
+     */
+    static PipeBufferPool& instance();
+
+    /**
+     * Get the size of the buffer which would be returned for a request
+     * of the given size
+     */
+    static size_t getAllocationSize(size_t size);
+
+    /**
+     * Get a buffer of (at least) the requested size.
+     *
+     * @param size the number of bytes requested
+     * @return a buffer of getAllocationSize(size) bytes
+     * @throws std::bad_alloc if memory allocation fails
+     */
+    uint8_t* allocate(size_t size);
+
+    /**
+     * Return a buffer to the pool.
+     *
+     * @param ptr the buffer to release (returned from allocate)
+     * @param size the size passed to allocate
+     */
+    void release(uint8_t* ptr, size_t size);
+
+    /**
+     * Set the maximum number of bytes the global lists may hold before
+     * released buffers are freed instead of cached (default 64MB).
+     *
+     * The limit doesn't include the thread caches; each thread may cache
+     * up to ThreadCacheSize buffers of every size class up to
+     * ThreadCacheMaxSize (~512kB) in addition to the global lists.
+     */
+    void setLimit(size_t limit) {
+        cacheLimit.store(limit);
+    }
+
+    /**
+     * Free all of the buffers in the global lists and the callers thread
+     * cache.
+     */
+    void purge();
+
+    /**
+     * Get the occupancy of the pool
+     */
+    unique_cJSON_ptr to_json() const {
+        unique_cJSON_ptr ret(cJSON_CreateObject());
+        unique_cJSON_ptr classes(cJSON_CreateArray());
+        size_t inUseBytes = 0;
+        size_t totalCachedBytes = 0;
+        for (size_t ii = 0; ii < NumSizeClasses; ++ii) {
+            const auto& sc = sizeClasses[ii];
+            const size_t size = MinSize << ii;
+            const size_t inUse = sc.inUse.load();
+            const size_t cached = sc.cached.load();
+            inUseBytes += inUse * size;
+            totalCachedBytes += cached * size;
+            if (inUse == 0 && cached == 0) {
+                continue;
+            }
+            cJSON* obj = cJSON_CreateObject();
+            cJSON_AddNumberToObject(obj, "size", size);
+            cJSON_AddNumberToObject(obj, "in_use", inUse);
+            cJSON_AddNumberToObject(obj, "cached", cached);
+            cJSON_AddItemToArray(classes.get(), obj);
+        }
+        cJSON_AddNumberToObject(ret.get(), "in_use_bytes", inUseBytes);
+        cJSON_AddNumberToObject(ret.get(), "cached_bytes", totalCachedBytes);
+        cJSON_AddNumberToObject(ret.get(), "limit", cacheLimit.load());
+        cJSON_AddItemToObject(ret.get(), "size_classes", classes.release());
+        return ret;
+    }
+
+protected:
+    PipeBufferPool() = default;
+
+    struct SizeClass {
+        std::mutex mutex;
+        std::vector<uint8_t*> buffers;
+        /// The number of buffers handed out and not yet released
+        std::atomic<size_t> inUse{0};
+        /// The number of buffers cached in the global list and
+        /// the thread caches
+        std::atomic<size_t> cached{0};
+    };
+
+    /// Get the index of the size class serving the size
+    static size_t getSizeClass(size_t size);
+
+    /// Move a buffer into the global list (or free it if we're above the
+    /// limit)
+    void releaseGlobal(size_t sizeclass, uint8_t* ptr);
+
+    /// Drop a buffer which was cached
+    void freeCached(size_t sizeclass, uint8_t* ptr);
+
+    friend struct PipeBufferPoolThreadCache;
+
+    std::array<SizeClass, NumSizeClasses> sizeClasses;
+    std::atomic<size_t> cachedBytes{0};
+    std::atomic<size_t> cacheLimit{64 * 1024 * 1024};
+};
+
+} // namespace cb
@@ -0,0 +1,134 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cJSON_utils.h>
+#include <platform/platform.h>
+#include <relaxed_atomic.h>
+
+#include <cstddef>
+
+namespace cb {
+
+/**
+ * The PipeStatistics is the process-wide aggregate of the counters
+ * kept by each cb::Pipe for the operations which move or allocate
+ * memory (packing the buffer and growing it).
+ *
+ * These operations are already expensive (a memmove or an allocation)
+ * so the pipes update the aggregate as they happen. The per-call
+ * counters (produce / consume) are only kept in each pipe as updating
+ * a shared counter for each call would introduce contention between
+ * the threads.
+ *
+ * The collection may be disabled by calling setEnabled(false).
+ */
+class PLATFORM_PUBLIC_API PipeStatistics {
+public:
+    /**
+     * Get the process-wide instance
+     */
+    static PipeStatistics& instance();
+
+    /**
+     * Enable (or disable) updating the process-wide counters
+     */
+    void setEnabled(bool enable) {
+        enabled.store(enable);
+    }
+
+    bool isEnabled() const {
+        return enabled.load();
+    }
+
+    /**
+     * Record that a pipe moved nbytes to the beginning of its buffer
+     */
+    void packed(size_t nbytes) {
+        if (isEnabled()) {
+            packs++;
+            bytesMoved += nbytes;
+        }
+    }
+
+    /**
+     * Record that a pipe moved to a new buffer of the given size (and
+     * copied nbytes into it)
+     */
+    void reallocated(size_t nbytes, size_t capacity) {
+        if (isEnabled()) {
+            reallocs++;
+            bytesMoved += nbytes;
+            peakCapacity.setIfGreater(capacity);
+        }
+    }
+
+    /**
+     * Record the capacity of a newly allocated pipe buffer
+     */
+    void allocated(size_t capacity) {
+        if (isEnabled()) {
+            peakCapacity.setIfGreater(capacity);
+        }
+    }
+
+    size_t getPacks() const {
+        return packs.load();
+    }
+
+    size_t getBytesMoved() const {
+        return bytesMoved.load();
+    }
+
+    size_t getReallocs() const {
+        return reallocs.load();
+    }
+
+    size_t getPeakCapacity() const {
+        return peakCapacity.load();
+    }
+
+    /**
+     * Reset all of the counters
+     */
+    void reset() {
+        packs.reset();
+        bytesMoved.reset();
+        reallocs.reset();
+        peakCapacity.reset();
+    }
+
+    unique_cJSON_ptr to_json() const {
+        unique_cJSON_ptr ret(cJSON_CreateObject());
+        cJSON_AddNumberToObject(ret.get(), "packs", getPacks());
+        cJSON_AddNumberToObject(ret.get(), "bytes_moved", getBytesMoved());
+        cJSON_AddNumberToObject(ret.get(), "reallocs", getReallocs());
+        cJSON_AddNumberToObject(ret.get(), "peak_capacity", getPeakCapacity());
+        return ret;
+    }
+
+protected:
+    PipeStatistics() = default;
+
+    Couchbase::RelaxedAtomic<bool> enabled{true};
+    Couchbase::RelaxedAtomic<size_t> packs;
+    Couchbase::RelaxedAtomic<size_t> bytesMoved;
+    Couchbase::RelaxedAtomic<size_t> reallocs;
+    Couchbase::RelaxedAtomic<size_t> peakCapacity;
+};
+
+} // namespace cb
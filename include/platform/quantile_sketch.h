@@ -0,0 +1,209 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/histogram.h>
+#include <platform/platform.h>
+#include <relaxed_atomic.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+
+namespace cb {
+
+/**
+ * A quantile sketch with a guaranteed relative error (based on DDSketch,
+ * https://arxiv.org/abs/1908.10693).
+ *
+ * The values are counted in logarithmically sized buckets where bucket i
+ * holds the values in (gamma^(i-1), gamma^i] with
+ * gamma = (1 + relativeAccuracy) / (1 - relativeAccuracy). Any value
+ * returned by percentile() is within relativeAccuracy of the actual value
+ * at that percentile (as long as the value is below maxTrackableValue);
+ * e.g. with the default accuracy of 1% a p99 of 1.2ms and 1.8ms are
+ * clearly different, while the exponential bins of MicrosecondHistogram
+ * put both in [1024, 2048).
+ *
+ * The memory used is bounded; all of the buckets up to maxTrackableValue
+ * are allocated up front (the number of buckets is roughly
+ * ln(maxTrackableValue) / (2 * relativeAccuracy); about 2200 counters for
+ * 64 bit values at 1%). Values above maxTrackableValue are counted in
+ * the last bucket.
+ *
+ * add() computes a logarithm and does a single relaxed increment, so it
+ * may be called from multiple threads without locking. Sketches with the
+ * same configuration may be merged.
+ *
+ * It provides the same add() interface as Histogram and may be used
+ * with GenericBlockTimer.
+ *
+ * The sketch tracks non-negative values only.
+ *
+ * Note: the non-trivial methods are defined in quantile_sketch.cc. If you
+ * want to add a new instantiation of this class; check the explicit
+ * template definition in quantile_sketch.cc.
+ */
+template <typename T, template <class> class Limits = std::numeric_limits>
+class QuantileSketch {
+public:
+    /**
+     * Build a quantile sketch.
+     *
+     * @param relativeAccuracy the relative accuracy of the values
+     *                         returned by percentile(); (0, 1)
+     * @param maxTrackableValue the highest value to track with the
+     *                          requested accuracy
+     * @throws std::invalid_argument for an invalid configuration
+     */
+    explicit QuantileSketch(double relativeAccuracy = 0.01,
+                            T maxTrackableValue = Limits<T>::max());
+
+    QuantileSketch(const QuantileSketch& other) = delete;
+    QuantileSketch(QuantileSketch&& other) = default;
+    QuantileSketch& operator=(const QuantileSketch& other) = delete;
+    QuantileSketch& operator=(QuantileSketch&& other) = default;
+
+    /**
+     * Add a value to this sketch.
+     *
+     * @param amount the size of the thing being added
+     * @param count the quantity at this size being added
+     */
+    void add(T amount, size_t count = 1) {
+        const double value = double(toRaw(amount));
+        if (value < 1.0) {
+            zeroCount.fetch_add(count);
+            return;
+        }
+        auto index = size_t(std::ceil(std::log(value) * multiplier));
+        if (index >= numBuckets) {
+            index = numBuckets - 1;
+        }
+        counts[index].fetch_add(count);
+    }
+
+    /**
+     * Get the value at the given percentile.
+     *
+     * @param percentile the requested percentile [0, 100]
+     * @return the value at the percentile (or Limits::min() if the sketch
+     *         is empty)
+     * @throws std::invalid_argument if percentile is outside [0, 100]
+     */
+    T percentile(double percentile) const;
+
+    /**
+     * Add the counts from another sketch to this sketch.
+     *
+     * @param other the sketch to add the counts from
+     * @throws std::invalid_argument if the sketches have a different
+     *                               configuration
+     */
+    void merge(const QuantileSketch& other);
+
+    /**
+     * Set all buckets to 0.
+     */
+    void reset();
+
+    /**
+     * Get the total number of samples counted.
+     */
+    size_t total() const;
+
+    double getRelativeAccuracy() const {
+        return relativeAccuracy;
+    }
+
+    /**
+     * Get the number of buckets (excluding the bucket for zero)
+     */
+    size_t size() const {
+        return numBuckets;
+    }
+
+    /**
+     * Convert a value to the raw value stored in the sketch
+     */
+    static uint64_t toRaw(T value) {
+        // Dividing two durations returns a value of the underlying Rep.
+        return uint64_t(value / T(1));
+    }
+
+    template <typename type, template <class> class limits>
+    friend std::ostream& operator<<(std::ostream& out,
+                                    const QuantileSketch<type, limits>& s);
+
+private:
+    /// Get the first integer value counted in the given bucket
+    uint64_t lowerBound(size_t index) const;
+
+    /// Get the value returned for the samples in the given bucket
+    T estimate(size_t index) const;
+
+    double relativeAccuracy;
+    double gamma;
+    // 1 / ln(gamma)
+    double multiplier;
+    size_t numBuckets;
+    Couchbase::RelaxedAtomic<size_t> zeroCount;
+    std::unique_ptr<Couchbase::RelaxedAtomic<size_t>[]> counts;
+};
+
+/**
+ * QuantileSketch of durations measured in microseconds.
+ */
+using MicrosecondQuantileSketch =
+        QuantileSketch<UnsignedMicroseconds, cb::duration_limits>;
+
+// How to print a sketch (like Histogram, but only the non-empty buckets
+// are printed as the sketch typically contains thousands of buckets).
+template <typename T, template <class> class Limits>
+std::ostream& operator<<(std::ostream& out,
+                         const QuantileSketch<T, Limits>& s) {
+    out << "{QuantileSketch: ";
+    bool needComma(false);
+    if (s.zeroCount.load() != 0) {
+        out << "[0, 1) = " << s.zeroCount.load();
+        needComma = true;
+    }
+    for (size_t ii = 0; ii < s.numBuckets; ++ii) {
+        const auto count = s.counts[ii].load();
+        if (count == 0) {
+            continue;
+        }
+        if (needComma) {
+            out << ", ";
+        }
+        out << "[" << s.lowerBound(ii) << ", ";
+        if (ii == s.numBuckets - 1) {
+            out << s.toRaw(Limits<T>::max());
+        } else {
+            out << s.lowerBound(ii + 1);
+        }
+        out << ") = " << count;
+        needComma = true;
+    }
+    out << "}";
+    return out;
+}
+
+} // namespace cb
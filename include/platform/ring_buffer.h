@@ -16,11 +16,31 @@
  */
 #pragma once
 
+#include <platform/cacheline_padded.h>
+
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
 #include <vector>
 
 namespace cb {
 
+/**
+ * Get the smallest power of two which is >= value (1 for 0)
+ */
+inline size_t roundUpToPowerOfTwo(size_t value) {
+    size_t ret = 1;
+    while (ret < value) {
+        ret <<= 1;
+    }
+    return ret;
+}
+
 /**
  * Template parameters
  * @param container_type the actual backing container, e.g. `std::vector<int>`
@@ -50,6 +70,17 @@ public:
         add_entry() = std::move(T(args...));
     }
 
+    /**
+     * Make the oldest element the newest one (#back()) without assigning
+     * a new value to it (for element types which should be reused, e.g.
+     * reset in place instead of being replaced).
+     *
+     * @return the new #back() element (still holding its old value)
+     */
+    T& rotate() {
+        return add_entry();
+    }
+
     // Front/back
     const T& front() const {
         return at(0);
@@ -128,7 +159,9 @@ public:
 protected:
     T& add_entry() {
         size_t last = first;
-        first = (first + 1) % array.size();
+        if (++first == array.size()) {
+            first = 0;
+        }
         return array[last];
     }
 
@@ -177,4 +210,236 @@ public:
     }
 };
 
+/**
+ * A bounded multi-producer / multi-consumer queue.
+ *
+ * Unlike the ring buffers above (which are single threaded and always
+ * accept a new element by overwriting the oldest one) the queue may be
+ * used from any number of threads without locking, and fails to push when
+ * it is full:
+ *
+ *     cb::MPMCRingBuffer<Task*> queue(1024);
+ *
+ *     // producers (e.g. the I/O threads)
+ *     if (!queue.try_push(task)) {
+ *         // full; back off (or run the task inline)
+ *     }
+ *
+ *     // consumers (e.g. the executors)
+ *     Task* task;
+ *     while (queue.try_pop(task)) {
+ *         task->run();
+ *     }
+ *
+ * The implementation is Dmitry Vyukov's bounded MPMC queue
+ * (http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue).
+ * Each slot holds a sequence number telling if it is ready to be written
+ * (sequence == position) or read (sequence == position + 1) for the
+ * current lap, so a producer and a consumer only touch the same slot
+ * after it has been handed over. The capacity is rounded up to a power of
+ * two so a position is mapped to its slot by masking, and the enqueue and
+ * dequeue positions live in separate cache lines.
+ *
+ * The batch versions of push and pop claim a run of slots with a single
+ * compare-and-swap of the position.
+ *
+ * @param T the element type (must be default constructible and move
+ *          assignable; the elements are kept in the slots until they are
+ *          overwritten)
+ */
+template <typename T>
+class MPMCRingBuffer {
+public:
+    /**
+     * @param capacity the maximum number of elements in the queue (rounded
+     *                 up to the next power of two, and at least 2 as a
+     *                 single slot can't tell a full queue from an
+     *                 empty one)
+     */
+    explicit MPMCRingBuffer(size_t capacity)
+        : mask(roundUpToPowerOfTwo(std::max(capacity, size_t(2))) - 1),
+          slots(new Slot[mask + 1]),
+          enqueuePosition(0),
+          dequeuePosition(0) {
+        for (size_t ii = 0; ii <= mask; ++ii) {
+            slots[ii].sequence.store(ii, std::memory_order_relaxed);
+        }
+    }
+
+    MPMCRingBuffer(const MPMCRingBuffer&) = delete;
+    MPMCRingBuffer& operator=(const MPMCRingBuffer&) = delete;
+
+    /**
+     * Try to add an element to the queue.
+     *
+     * @return true if the element was added, false if the queue is full
+     */
+    bool try_push(const T& value) {
+        return push(value);
+    }
+
+    bool try_push(T&& value) {
+        return push(std::move(value));
+    }
+
+    /**
+     * Try to add the elements in [first, last) to the queue. The elements
+     * are added in order as a single run (i.e. consumers see them
+     * one after the other) until the queue is full.
+     *
+     * @return the number of elements added
+     */
+    template <typename InputIterator>
+    size_t try_push(InputIterator first, InputIterator last) {
+        const auto count = size_t(std::distance(first, last));
+        size_t pos;
+        const size_t claimed = claim(*enqueuePosition, 0, count, pos);
+        for (size_t ii = 0; ii < claimed; ++ii, ++first) {
+            Slot& slot = slots[(pos + ii) & mask];
+            slot.value = *first;
+            slot.sequence.store(pos + ii + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    /**
+     * Try to remove the oldest element from the queue.
+     *
+     * @param value where to store the element
+     * @return true if an element was removed, false if the queue is empty
+     */
+    bool try_pop(T& value) {
+        size_t pos;
+        if (claim(*dequeuePosition, 1, 1, pos) == 0) {
+            return false;
+        }
+        Slot& slot = slots[pos & mask];
+        value = std::move(slot.value);
+        slot.sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Try to remove up to max elements from the queue (oldest first).
+     *
+     * @param out where to write the elements
+     * @param max the maximum number of elements to remove
+     * @return the number of elements removed
+     */
+    template <typename OutputIterator>
+    size_t try_pop(OutputIterator out, size_t max) {
+        size_t pos;
+        const size_t claimed = claim(*dequeuePosition, 1, max, pos);
+        for (size_t ii = 0; ii < claimed; ++ii, ++out) {
+            Slot& slot = slots[(pos + ii) & mask];
+            *out = std::move(slot.value);
+            slot.sequence.store(pos + ii + mask + 1,
+                                std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    /**
+     * Get the approximate number of elements in the queue (the positions
+     * may be moved by other threads while they are read).
+     */
+    size_t size() const {
+        const auto dequeue = dequeuePosition->load(std::memory_order_relaxed);
+        const auto enqueue = enqueuePosition->load(std::memory_order_relaxed);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    /**
+     * Claim a slot and copy (or move) the value into it (the value isn't
+     * touched if the queue is full)
+     */
+    template <typename U>
+    bool push(U&& value) {
+        size_t pos;
+        if (claim(*enqueuePosition, 0, 1, pos) == 0) {
+            return false;
+        }
+        Slot& slot = slots[pos & mask];
+        slot.value = std::forward<U>(value);
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Claim up to max consecutive slots starting at the given position.
+     * A slot may be claimed once its sequence is position + offset (0 for
+     * the producers and 1 for the consumers).
+     *
+     * @param position the enqueue or dequeue position to move
+     * @param offset what to add to the position to get the sequence of
+     *               a slot ready to be claimed
+     * @param max the maximum number of slots to claim
+     * @param pos set to the position of the first claimed slot
+     * @return the number of slots claimed (0 if the queue is full/empty)
+     */
+    size_t claim(std::atomic<size_t>& position,
+                 size_t offset,
+                 size_t max,
+                 size_t& pos) {
+        if (max == 0) {
+            return 0;
+        }
+        if (max > capacity()) {
+            max = capacity();
+        }
+        pos = position.load(std::memory_order_relaxed);
+        while (true) {
+            size_t available = 0;
+            bool retry = false;
+            while (available < max) {
+                const size_t expected = pos + available + offset;
+                const size_t seq = slots[(pos + available) & mask]
+                                           .sequence.load(
+                                                   std::memory_order_acquire);
+                if (seq != expected) {
+                    // Another thread moved past the slot if it is ahead of
+                    // us (when checking the first slot), otherwise the
+                    // queue is full (or empty) from this slot.
+                    retry = (available == 0) && (intptr_t(seq - expected) > 0);
+                    break;
+                }
+                ++available;
+            }
+
+            if (retry) {
+                pos = position.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (available == 0) {
+                return 0;
+            }
+            if (position.compare_exchange_weak(pos,
+                                               pos + available,
+                                               std::memory_order_relaxed)) {
+                return available;
+            }
+            // pos has been updated to the current position; try again
+        }
+    }
+
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    CachelinePadded<std::atomic<size_t>> enqueuePosition;
+    CachelinePadded<std::atomic<size_t>> dequeuePosition;
+};
+
 } // namespace
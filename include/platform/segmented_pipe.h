@@ -0,0 +1,474 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cJSON_utils.h>
+#include <platform/cb_malloc.h>
+#include <platform/platform.h>
+#include <platform/sized_buffer.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+
+namespace cb {
+
+/**
+ * The SegmentedPipe class is a variant of cb::Pipe backed by a list of
+ * fixed size chunks instead of a single linear buffer.
+ *
+ * cb::Pipe grows by doubling its buffer with realloc and then packs it
+ * by moving the data to the beginning of the buffer, which for large
+ * values means copying megabytes of data (and temporarily using twice the
+ * memory). The SegmentedPipe never copies data:
+ *
+ *    * ensureCapacity appends new chunks to the end of the list
+ *    * consuming all of the data in a chunk releases the chunk
+ *    * pack is a no-op
+ *
+ * It provides the same produce / consume contract as cb::Pipe, but
+ * the memory area provided to the callbacks (and returned from rdata() /
+ * wdata()) is the contiguous part of the data (or free space) within a
+ * single chunk. Use the iovec-style rdata(iov, iovcnt) and
+ * wdata(iov, iovcnt) to get all of the segments (to be used with
+ * sendmsg / readv etc).
+ *
+ * All addresses previously returned stay valid until the data is consumed
+ * (they're never moved), but the SegmentedPipe is _not_ thread-safe.
+ *
+ * Implementation details:
+ *
+ * The chunks are kept in a deque. The data in the pipe starts at
+ * read_offset in the first chunk and ends at write_offset in the chunk
+ * at write_chunk. All chunks after write_chunk are empty (allocated by
+ * ensureCapacity).
+ */
+class SegmentedPipe {
+public:
+    /**
+     * Initialize a pipe with the given chunk size.
+     *
+     * The minimum chunk size is 128 bytes (to match cb::Pipe). The pipe
+     * starts off with a single chunk.
+     *
+     * @param size The size of each chunk in the pipe (default 2k)
+     * @throws std::bad_alloc if memory allocation fails
+     */
+    explicit SegmentedPipe(size_t size = 2048)
+        : chunk_size(std::max(size, size_t(128))) {
+        appendChunk();
+    }
+
+    /**
+     * Make sure that one may insert at least the specified number
+     * of bytes in the pipe by appending new chunks. Note that the
+     * space isn't contiguous if it spans multiple chunks.
+     *
+     * This method never moves any data.
+     *
+     * @param nbytes The number of bytes needed in the pipe
+     * @return The number of bytes of available space in the pipe (for the
+     *         write end)
+     * @throws std::bad_alloc if memory allocation fails
+     */
+    size_t ensureCapacity(size_t nbytes) {
+        while (wsize() < nbytes) {
+            appendChunk();
+        }
+        advanceWriteChunk();
+        return wsize();
+    }
+
+    /**
+     * Get the size of each chunk in the pipe
+     */
+    size_t getChunkSize() const {
+        return chunk_size;
+    }
+
+    /**
+     * Get the current allocation size of the pipe (all chunks)
+     */
+    size_t capacity() const {
+        return chunks.size() * chunk_size;
+    }
+
+    /**
+     * Read the number of bytes currently available in the read end
+     * of the pipe (all chunks)
+     */
+    size_t rsize() const {
+        if (write_chunk == 0) {
+            return write_offset - read_offset;
+        }
+        return (chunk_size - read_offset) + (write_chunk - 1) * chunk_size +
+               write_offset;
+    }
+
+    /**
+     * Get the first contiguous segment of the available read data
+     */
+    cb::const_byte_buffer rdata() const {
+        return getAvailableReadSpace();
+    }
+
+    /**
+     * Get the segments of the available read data (like an iovec)
+     *
+     * @param iov where to store the segments
+     * @param iovcnt the number of elements in iov
+     * @return the number of segments stored in iov
+     */
+    size_t rdata(cb::const_byte_buffer* iov, size_t iovcnt) const {
+        size_t ii = 0;
+        for (size_t chunk = 0; chunk <= write_chunk && ii < iovcnt; ++chunk) {
+            const size_t start = chunk == 0 ? read_offset : 0;
+            const size_t end = chunk == write_chunk ? write_offset : chunk_size;
+            if (start != end) {
+                iov[ii++] = {chunks[chunk].get() + start, end - start};
+            }
+        }
+        return ii;
+    }
+
+    /**
+     * Returns the number of bytes available to be written to in the
+     * write end of the pipe (all chunks)
+     */
+    size_t wsize() const {
+        return (chunk_size - write_offset) +
+               (chunks.size() - write_chunk - 1) * chunk_size;
+    }
+
+    /**
+     * Get the first contiguous segment of the available write buffer
+     */
+    cb::byte_buffer wdata() const {
+        return getAvailableWriteSpace();
+    }
+
+    /**
+     * Get the segments of the available write buffer (like an iovec)
+     *
+     * @param iov where to store the segments
+     * @param iovcnt the number of elements in iov
+     * @return the number of segments stored in iov
+     */
+    size_t wdata(cb::byte_buffer* iov, size_t iovcnt) const {
+        size_t ii = 0;
+        for (size_t chunk = write_chunk; chunk < chunks.size() && ii < iovcnt;
+             ++chunk) {
+            const size_t start = chunk == write_chunk ? write_offset : 0;
+            if (start != chunk_size) {
+                iov[ii++] = {chunks[chunk].get() + start, chunk_size - start};
+            }
+        }
+        return ii;
+    }
+
+    /**
+     * Try to produce a number of bytes by providing a callback function
+     * which will receive the buffer where the data may be inserted
+     *
+     * @param producer a callback function to produce data into the
+     *                 continuous memory area from ptr and size bytes
+     *                 long
+     * @return the number of bytes produced
+     */
+    ssize_t produce(std::function<ssize_t(void* /* ptr */, size_t /* size */)>
+                            producer) {
+        return produce<decltype(producer)&>(producer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Producer>
+    auto produce(Producer&& producer) -> decltype(
+            ssize_t(producer(static_cast<void*>(nullptr), size_t(0)))) {
+        auto avail = getAvailableWriteSpace();
+
+        const ssize_t ret =
+                producer(static_cast<void*>(avail.data()), avail.size());
+
+        if (ret > 0) {
+            produced(ret);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Try to produce a number of bytes by providing a callback function
+     * which will receive the buffer where the data may be inserted
+     *
+     * @param producer a callback function to produce data into the
+     *                 provided buffer.
+     * @return the number of bytes produced
+     */
+    ssize_t produce(std::function<ssize_t(cb::byte_buffer)> producer) {
+        return produce<decltype(producer)&>(producer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Producer>
+    auto produce(Producer&& producer)
+            -> decltype(ssize_t(producer(cb::byte_buffer{}))) {
+        auto avail = getAvailableWriteSpace();
+
+        const ssize_t ret = producer({avail.data(), avail.size()});
+
+        if (ret > 0) {
+            produced(ret);
+        }
+
+        return ret;
+    }
+
+    /**
+     * A number of bytes was made available for the consumer. The bytes
+     * may span multiple chunks (for instance after a readv into the
+     * segments returned from wdata(iov, iovcnt)).
+     */
+    void produced(size_t nbytes) {
+        if (nbytes > wsize()) {
+            throw std::logic_error(
+                    "SegmentedPipe::produced(): Produced bytes exceeds "
+                    "the number of available bytes");
+        }
+
+        while (nbytes > 0) {
+            advanceWriteChunk();
+            const size_t count = std::min(nbytes, chunk_size - write_offset);
+            write_offset += count;
+            nbytes -= count;
+        }
+        advanceWriteChunk();
+    }
+
+    /**
+     * Try to consume data from the buffer by providing a callback function
+     *
+     * @param producer a callback function to consume data from the provided
+     *                 continuous memory area from ptr and size bytes long.
+     *                 The number of bytes consumed should be returned.
+     * @return the number of bytes consumed
+     */
+    ssize_t consume(std::function<ssize_t(const void* /* ptr */,
+                                          size_t /* size */)> consumer) {
+        return consume<decltype(consumer)&>(consumer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Consumer>
+    auto consume(Consumer&& consumer)
+            -> decltype(ssize_t(consumer(static_cast<const void*>(nullptr),
+                                         size_t(0)))) {
+        auto avail = getAvailableReadSpace();
+        const ssize_t ret =
+                consumer(static_cast<const void*>(avail.data()), avail.size());
+        if (ret > 0) {
+            consumed(ret);
+        }
+        return ret;
+    }
+
+    /**
+     * Try to consume data from the buffer by providing a callback function
+     *
+     * @param producer a callback function to consume data from the provided
+     *                 memory area. The number of bytes consumed should be
+     *                 returned.
+     * @return the number of bytes consumed
+     */
+    ssize_t consume(std::function<ssize_t(cb::const_byte_buffer)> consumer) {
+        return consume<decltype(consumer)&>(consumer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Consumer>
+    auto consume(Consumer&& consumer)
+            -> decltype(ssize_t(consumer(cb::const_byte_buffer{}))) {
+        auto avail = getAvailableReadSpace();
+        const ssize_t ret = consumer({avail.data(), avail.size()});
+        if (ret > 0) {
+            consumed(ret);
+        }
+        return ret;
+    }
+
+    /**
+     * The number of bytes just removed from the consumer end of the pipe.
+     * The bytes may span multiple chunks, and all chunks which are
+     * completely consumed are released.
+     */
+    void consumed(size_t nbytes) {
+        if (nbytes > rsize()) {
+            throw std::logic_error(
+                    "SegmentedPipe::consumed(): Consumed bytes exceeds "
+                    "the number of available bytes");
+        }
+
+        while (nbytes > 0) {
+            const size_t end = write_chunk == 0 ? write_offset : chunk_size;
+            const size_t count = std::min(nbytes, end - read_offset);
+            read_offset += count;
+            nbytes -= count;
+            if (read_offset == chunk_size && write_chunk > 0) {
+                chunks.pop_front();
+                --write_chunk;
+                read_offset = 0;
+            }
+        }
+
+        if (empty()) {
+            // Start over at the beginning of the current chunk
+            read_offset = write_offset = 0;
+        }
+    }
+
+    /**
+     * The SegmentedPipe never needs to be packed (data is never moved);
+     * provided for compatibility with cb::Pipe.
+     *
+     * @return true if the pipe is empty
+     */
+    bool pack() {
+        return empty();
+    }
+
+    /**
+     * Is this pipe empty (the consumer end completely caught up with
+     * the producer)
+     */
+    bool empty() const {
+        return write_chunk == 0 && read_offset == write_offset;
+    }
+
+    /**
+     * Is this pipe full or not (no more space without appending chunks)
+     */
+    bool full() const {
+        return wsize() == 0;
+    }
+
+    /**
+     * Clear all of the content in the pipe. All chunks but one are
+     * released.
+     */
+    void clear() {
+        chunks.resize(1);
+        write_chunk = 0;
+        write_offset = read_offset = 0;
+    }
+
+    /**
+     * Get the (internal) properties of the pipe
+     */
+    unique_cJSON_ptr to_json() const {
+        unique_cJSON_ptr ret(cJSON_CreateObject());
+        cJSON_AddNumberToObject(ret.get(), "chunk_size", chunk_size);
+        cJSON_AddNumberToObject(ret.get(), "chunks", chunks.size());
+        cJSON_AddNumberToObject(ret.get(), "read_offset", read_offset);
+        cJSON_AddNumberToObject(ret.get(), "write_chunk", write_chunk);
+        cJSON_AddNumberToObject(ret.get(), "write_offset", write_offset);
+        cJSON_AddBoolToObject(ret.get(), "empty", empty());
+        return ret;
+    }
+
+protected:
+    /**
+     * Get information of the _unused_ contiguous space in the current
+     * write chunk.
+     */
+    cb::byte_buffer getAvailableWriteSpace() const {
+        return {chunks[write_chunk].get() + write_offset,
+                chunk_size - write_offset};
+    }
+
+    /**
+     * Get information of the contiguous data the consumer may read from
+     * the first chunk.
+     */
+    cb::const_byte_buffer getAvailableReadSpace() const {
+        const size_t end = write_chunk == 0 ? write_offset : chunk_size;
+        return {chunks.front().get() + read_offset, end - read_offset};
+    }
+
+    /**
+     * Allocate a new chunk and put it at the end of the list of chunks
+     */
+    void appendChunk() {
+        chunks.emplace_back(static_cast<uint8_t*>(cb_malloc(chunk_size)));
+        if (!chunks.back()) {
+            chunks.pop_back();
+            throw std::bad_alloc();
+        }
+    }
+
+    /**
+     * If the current write chunk is full, move on to the next chunk
+     * (if one is available)
+     */
+    void advanceWriteChunk() {
+        if (write_offset == chunk_size && write_chunk + 1 < chunks.size()) {
+            ++write_chunk;
+            write_offset = 0;
+        }
+    }
+
+    struct cb_malloc_deleter {
+        void operator()(uint8_t* ptr) {
+            cb_free(static_cast<void*>(ptr));
+        }
+    };
+
+    // The size of each chunk
+    const size_t chunk_size;
+
+    // The chunks in use (the first chunk is the one we read from)
+    std::deque<std::unique_ptr<uint8_t, cb_malloc_deleter>> chunks;
+
+    // The index (in chunks) of the chunk we may write to
+    size_t write_chunk = 0;
+
+    // The offset in the write chunk where we may start write
+    size_t write_offset = 0;
+
+    // The offset in the first chunk where we may start reading
+    size_t read_offset = 0;
+};
+
+} // namespace cb
@@ -0,0 +1,217 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <platform/corestore.h>
+#include <platform/processclock.h>
+#include <relaxed_atomic.h>
+
+#include <chrono>
+#include <type_traits>
+
+namespace cb {
+
+/**
+ * A counter sharded per core.
+ *
+ * A Couchbase::RelaxedAtomic<T> counter updated by all of the worker
+ * threads bounces its cache line between all of the cores. The
+ * ShardedCounter keeps a counter per core (in a padded CoreStore) so an
+ * update only touches the cache line of the core the caller runs on, and
+ * the shards are summed when the counter is read. Use it for counters
+ * which are updated a lot more often than they are read (e.g. stats).
+ *
+ * It provides the same operators as RelaxedAtomic so that a member may be
+ * changed from one to the other, with the following differences:
+ *
+ *  - The operators which modify the counter (++, --, +=, -=, fetch_add,
+ *    fetch_sub) don't return the value of the counter as that would
+ *    require reading all shards (code using the returned value fails to
+ *    compile instead of silently getting a slow and racy result).
+ *  - store() / reset() aren't atomic with respect to concurrent updates
+ *    (an update from another core in between may be lost, the same as if
+ *    it happened just before the store).
+ *  - Values may be decremented on another core than they were
+ *    incremented on, so a single shard may wrap around; the total is
+ *    still correct as the shards are summed with modular arithmetic.
+ *
+ * Reading the total is O(number of cores). When a slightly old value is
+ * acceptable (e.g. to report the counter frequently) loadApproximate()
+ * returns a total cached for up to the maximum age given to the
+ * constructor.
+ */
+template <typename T>
+class ShardedCounter {
+    static_assert(std::is_integral<T>::value,
+                  "ShardedCounter should only be templated over integral "
+                  "types");
+
+public:
+    /**
+     * @param maxApproximateAge how old the value returned by
+     *                          loadApproximate() may be
+     * @param clockSource the clock used to age the cached value
+     */
+    explicit ShardedCounter(std::chrono::nanoseconds maxApproximateAge =
+                                    std::chrono::milliseconds(100),
+                            ProcessClockSource& clockSource =
+                                    cb::defaultProcessClockSource())
+        : maxApproximateAge(maxApproximateAge),
+          clockSource(clockSource) {
+    }
+
+    ShardedCounter(const T& initial) : ShardedCounter() {
+        store(initial);
+    }
+
+    explicit ShardedCounter(const ShardedCounter& other)
+        : ShardedCounter(other.maxApproximateAge, other.clockSource) {
+        store(other.load());
+    }
+
+    operator T() const {
+        return load();
+    }
+
+    /**
+     * Get the total of all shards
+     */
+    T load() const {
+        // Sum as unsigned so that the wrap around of the shards is well
+        // defined for signed types
+        using U = typename std::make_unsigned<T>::type;
+        U ret = 0;
+        for (const auto& shard : shards) {
+            ret += U(shard.load());
+        }
+        return T(ret);
+    }
+
+    /**
+     * Get the total of all shards as it was at most maxApproximateAge ago
+     * (the total is recomputed by the first call after the cached value
+     * has expired).
+     */
+    T loadApproximate() const {
+        const auto now = clockSource.now().time_since_epoch().count();
+        const auto maxAge = std::chrono::duration_cast<
+                                    ProcessClock::duration>(maxApproximateAge)
+                                    .count();
+        const auto refreshed = approximateTime.load();
+        if (refreshed != 0 && now - refreshed <= maxAge) {
+            return approximate.load();
+        }
+        const auto ret = load();
+        approximate.store(ret);
+        approximateTime.store(now);
+        return ret;
+    }
+
+    /**
+     * Set the counter to the given value (by setting the shard of the
+     * current core to the value and all others to 0)
+     */
+    void store(T desired) {
+        auto& local = shards.get(std::nothrow);
+        for (auto& shard : shards) {
+            if (&shard != &local) {
+                shard.store(0);
+            }
+        }
+        local.store(desired);
+        approximateTime.store(0);
+    }
+
+    void fetch_add(T arg) {
+        shards.get(std::nothrow).fetch_add(arg);
+    }
+
+    void fetch_sub(T arg) {
+        shards.get(std::nothrow).fetch_sub(arg);
+    }
+
+    ShardedCounter& operator=(const ShardedCounter& rhs) {
+        store(rhs.load());
+        return *this;
+    }
+
+    ShardedCounter& operator=(T val) {
+        store(val);
+        return *this;
+    }
+
+    ShardedCounter& operator+=(const T rhs) {
+        fetch_add(rhs);
+        return *this;
+    }
+
+    ShardedCounter& operator+=(const ShardedCounter& rhs) {
+        fetch_add(rhs.load());
+        return *this;
+    }
+
+    ShardedCounter& operator-=(const T rhs) {
+        fetch_sub(rhs);
+        return *this;
+    }
+
+    ShardedCounter& operator-=(const ShardedCounter& rhs) {
+        fetch_sub(rhs.load());
+        return *this;
+    }
+
+    void operator++() {
+        fetch_add(1);
+    }
+
+    void operator++(int) {
+        fetch_add(1);
+    }
+
+    void operator--() {
+        fetch_sub(1);
+    }
+
+    void operator--(int) {
+        fetch_sub(1);
+    }
+
+    void reset() {
+        store(0);
+    }
+
+    /**
+     * Get the number of shards
+     */
+    size_t getNumShards() const {
+        return shards.size();
+    }
+
+private:
+    CoreStore<Couchbase::RelaxedAtomic<T>> shards;
+
+    const std::chrono::nanoseconds maxApproximateAge;
+    ProcessClockSource& clockSource;
+    /// The cached total returned by loadApproximate()
+    mutable Couchbase::RelaxedAtomic<T> approximate;
+    /// When the cached total was computed (ProcessClock ticks; 0 if it
+    /// needs to be recomputed)
+    mutable Couchbase::RelaxedAtomic<ProcessClock::rep> approximateTime;
+};
+
+} // namespace cb
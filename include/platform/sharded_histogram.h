@@ -0,0 +1,191 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/corestore.h>
+#include <platform/loglinear_histogram.h>
+
+#include <iostream>
+#include <iterator>
+
+namespace cb {
+
+/**
+ * A histogram sharded per core.
+ *
+ * Recording a value in a single histogram from many threads means that
+ * all of the threads do atomic increments on the same cache lines. The
+ * ShardedHistogram keeps one LogLinearHistogram (with its own counter
+ * array) per core in a CoreStore, so add() only touches the counters of
+ * the core the caller runs on. The shards are merged when the histogram
+ * is read (which is expected to be a lot less frequent than recording).
+ *
+ * It may be used as the histogram for GenericBlockTimer:
+ *
+ *     cb::MicrosecondShardedHistogram histogram(std::chrono::seconds(10), 2);
+ *     {
+ *         GenericBlockTimer<cb::MicrosecondShardedHistogram, 0> timer(
+ *                 &histogram);
+ *         ...
+ *     }
+ *
+ * Each shard allocates the full counter array of the LogLinearHistogram,
+ * so the memory used is the size of one histogram times the number of
+ * cores. With 2 significant digits one histogram uses ~14kB for values
+ * up to 10^6, ~26kB up to 3.6 * 10^9 (an hour in microseconds) and ~58kB
+ * for the full range of a 64 bit value (~3.7MB on a 64 core machine).
+ * The range and precision must therefore be provided explicitly.
+ */
+template <typename T, template <class> class Limits = std::numeric_limits>
+class ShardedHistogram {
+public:
+    using histogram_type = LogLinearHistogram<T, Limits>;
+
+    /**
+     * Build a sharded histogram (see LogLinearHistogram for a
+     * description of the parameters)
+     *
+     * @throws std::invalid_argument for an invalid configuration
+     */
+    ShardedHistogram(T highestTrackableValue, int significantDigits)
+        : shards(highestTrackableValue, significantDigits) {
+    }
+
+    /**
+     * Get the number of bytes used by the counters of all shards
+     */
+    size_t getMemoryUsage() const {
+        return getLayout().size() * sizeof(size_t) * shards.size();
+    }
+
+    ShardedHistogram(const ShardedHistogram&) = delete;
+    ShardedHistogram& operator=(const ShardedHistogram&) = delete;
+
+    /**
+     * Add a value to the shard for the current core.
+     *
+     * @param amount the size of the thing being added
+     * @param count the quantity at this size being added
+     */
+    void add(T amount, size_t count = 1) {
+        shards.get(std::nothrow).add(amount, count);
+    }
+
+    /**
+     * Add a batch of values to the shard for the current core (see
+     * LogLinearHistogram::add).
+     */
+    void add(cb::sized_buffer<const T> values) {
+        shards.get(std::nothrow).add(values);
+    }
+
+    /**
+     * Set all bins in all shards to 0.
+     */
+    void reset() {
+        for (auto& shard : shards) {
+            shard.reset();
+        }
+    }
+
+    /**
+     * Get the total number of samples counted in all shards.
+     */
+    size_t total() const {
+        size_t ret = 0;
+        for (const auto& shard : shards) {
+            ret += shard.total();
+        }
+        return ret;
+    }
+
+    /**
+     * Get the value at the given percentile of the samples in all shards
+     * (see LogLinearHistogram::percentile)
+     */
+    T percentile(double percentile) const {
+        return aggregate().percentile(percentile);
+    }
+
+    /**
+     * Merge all of the shards into a single histogram (which may be
+     * iterated and printed like any other histogram).
+     */
+    histogram_type aggregate() const {
+        const auto& layout = shards.begin()->getLayout();
+        histogram_type ret(histogram_type::fromRaw(
+                                   layout.getHighestTrackableValue()),
+                           layout.getSignificantDigits());
+        for (const auto& shard : shards) {
+            ret.merge(shard);
+        }
+        return ret;
+    }
+
+    /**
+     * Get a copy of the histogram (same as aggregate(); provided so the
+     * histograms may be used interchangeably)
+     */
+    histogram_type snapshot() const {
+        return aggregate();
+    }
+
+    /**
+     * Merge all of the shards into a single histogram and reset the
+     * shards, returning the values recorded since the previous call
+     * (see LogLinearHistogram::drain).
+     */
+    histogram_type drain() {
+        auto ret = shards.begin()->drain();
+        for (auto it = std::next(shards.begin()); it != shards.end(); ++it) {
+            ret.merge(it->drain());
+        }
+        return ret;
+    }
+
+    /**
+     * Get the layout of the bins (shared by all shards)
+     */
+    const LogLinearLayout& getLayout() const {
+        return shards.begin()->getLayout();
+    }
+
+    /**
+     * Get the number of shards
+     */
+    size_t getNumShards() const {
+        return shards.size();
+    }
+
+private:
+    CoreStore<histogram_type> shards;
+};
+
+/**
+ * ShardedHistogram of durations measured in microseconds.
+ */
+using MicrosecondShardedHistogram =
+        ShardedHistogram<UnsignedMicroseconds, cb::duration_limits>;
+
+// How to print a sharded histogram (the shards are merged first)
+template <typename T, template <class> class Limits>
+std::ostream& operator<<(std::ostream& out,
+                         const ShardedHistogram<T, Limits>& h) {
+    return out << h.aggregate();
+}
+
+} // namespace cb
@@ -0,0 +1,333 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include <platform/corestore.h>
+#include <platform/non_negative_counter.h>
+#include <relaxed_atomic.h>
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+
+namespace cb {
+
+/**
+ * A NonNegativeCounter sharded per core.
+ *
+ * NonNegativeCounter::fetch_sub() is a compare-exchange loop on a single
+ * value, which spins when the counter is updated from many threads (e.g.
+ * memory usage counters). The ShardedNonNegativeCounter keeps a signed
+ * delta per core (in a padded CoreStore) which is updated with a single
+ * relaxed atomic, and only moves the delta of a core to the shared total
+ * when it exceeds the budget (in either direction).
+ *
+ * A delta is moved so that the sum of the total and the deltas may be
+ * too high (never too low) while it is being moved: an increment is
+ * added to the total before it is removed from the shard, and a
+ * decrement is removed from the shard before it is subtracted from the
+ * total (with fences between the two steps). The amount moved is
+ * subtracted from the shard (rather than exchanging the shard with 0), so
+ * updates of the shard made while the delta is being moved aren't lost.
+ *
+ * The non-negative invariant is enforced (with the same underflow
+ * policies as NonNegativeCounter) when a decrement is moved to the total
+ * and when the counter is read. A core may hold a negative delta bigger
+ * than the total while other cores hold the matching increments, and the
+ * sum read by load() may be off while a delta is moved, so neither is
+ * treated as an underflow directly. Instead the deltas of all cores are
+ * folded into the total (serialised by a mutex; the increments first)
+ * and the total is checked again. Only if it is still too small after
+ * folding the deltas a second time (if the first pass moved anything) is
+ * the underflow policy invoked; the number of passes is bounded so that
+ * a real underflow doesn't keep spinning while other cores keep updating
+ * their deltas. If the policy throws, the operation which caused the
+ * underflow isn't applied (like NonNegativeCounter).
+ *
+ * It provides the same operators as NonNegativeCounter, with the same
+ * differences as cb::ShardedCounter: the operators which modify the
+ * counter don't return the value (that would require reading all
+ * shards), and store() isn't atomic with respect to concurrent updates.
+ *
+ * load() returns the total plus the deltas of all cores; it is O(number
+ * of cores), and updates made while it runs may or may not be included.
+ *
+ * The underflow policy must be stateless (it is constructed when needed).
+ *
+ * @tparam Shards where to keep the deltas (one per core by default; a
+ *                different store may be used to control which shard is
+ *                used, e.g. in unit tests). It must provide
+ *                get(std::nothrow), size() and iteration over the shards.
+ */
+template <typename T,
+          template <class> class UnderflowPolicy = DefaultUnderflowPolicy,
+          typename Shards = CoreStore<
+                  Couchbase::RelaxedAtomic<typename std::make_signed<T>::type>>>
+class ShardedNonNegativeCounter {
+    static_assert(std::is_unsigned<T>::value,
+                  "ShardedNonNegativeCounter should only be templated over "
+                  "unsigned types");
+
+public:
+    using Delta = typename std::make_signed<T>::type;
+
+    /**
+     * @param initial the initial value of the counter
+     * @param budget how big the delta of a core may grow (in either
+     *               direction) before it is moved to the total
+     * @throws std::invalid_argument if the budget isn't positive
+     */
+    explicit ShardedNonNegativeCounter(T initial = 0, Delta budget = 1024)
+        : budget(budget), value(initial) {
+        if (budget <= 0) {
+            throw std::invalid_argument(
+                    "ShardedNonNegativeCounter: budget must be positive");
+        }
+    }
+
+    ShardedNonNegativeCounter(const ShardedNonNegativeCounter& other)
+        : ShardedNonNegativeCounter(other.load(), other.budget) {
+    }
+
+    operator T() const {
+        return load();
+    }
+
+    /**
+     * Get the value of the counter (invoking the underflow policy if the
+     * sum of the deltas of all cores made it negative)
+     */
+    T load() const {
+        const T current = value.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        Delta pending = 0;
+        for (const auto& shard : shards) {
+            pending += shard.load();
+        }
+        if (pending >= 0) {
+            return current + T(pending);
+        }
+        if (current >= T(-pending)) {
+            return current - T(-pending);
+        }
+
+        // The sum is negative (or a delta was moved while we read it);
+        // fold the deltas of all cores into the total and check again
+        std::lock_guard<std::mutex> guard(mutex);
+        fold(0);
+        return value.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Set the counter to the given value (the deltas of all cores are
+     * cleared)
+     */
+    void store(T desired) {
+        std::lock_guard<std::mutex> guard(mutex);
+        for (auto& shard : shards) {
+            shard.store(0);
+        }
+        value.store(desired, std::memory_order_relaxed);
+    }
+
+    void fetch_add(T arg) {
+        auto& local = shards.get(std::nothrow);
+        const auto delta = Delta(arg);
+        const Delta pending = local.fetch_add(delta) + delta;
+        if (pending >= budget) {
+            value.fetch_add(T(pending), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            local.fetch_sub(pending);
+        }
+    }
+
+    void fetch_sub(T arg) {
+        auto& local = shards.get(std::nothrow);
+        const auto delta = Delta(arg);
+        const Delta pending = local.fetch_sub(delta) - delta;
+        if (pending <= -budget) {
+            local.fetch_sub(pending);
+            std::atomic_thread_fence(std::memory_order_release);
+            if (trySubtract(T(-pending))) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> guard(mutex);
+            try {
+                fold(T(-pending));
+            } catch (...) {
+                // Put back the part of the delta which wasn't caused
+                // by this operation
+                local.fetch_add(pending + delta);
+                throw;
+            }
+        }
+    }
+
+    ShardedNonNegativeCounter& operator=(const ShardedNonNegativeCounter& rhs) {
+        store(rhs.load());
+        return *this;
+    }
+
+    ShardedNonNegativeCounter& operator=(T val) {
+        store(val);
+        return *this;
+    }
+
+    ShardedNonNegativeCounter& operator+=(const T rhs) {
+        fetch_add(rhs);
+        return *this;
+    }
+
+    ShardedNonNegativeCounter& operator+=(
+            const ShardedNonNegativeCounter& rhs) {
+        fetch_add(rhs.load());
+        return *this;
+    }
+
+    ShardedNonNegativeCounter& operator-=(const T rhs) {
+        fetch_sub(rhs);
+        return *this;
+    }
+
+    ShardedNonNegativeCounter& operator-=(
+            const ShardedNonNegativeCounter& rhs) {
+        fetch_sub(rhs.load());
+        return *this;
+    }
+
+    void operator++() {
+        fetch_add(1);
+    }
+
+    void operator++(int) {
+        fetch_add(1);
+    }
+
+    void operator--() {
+        fetch_sub(1);
+    }
+
+    void operator--(int) {
+        fetch_sub(1);
+    }
+
+    Delta getBudget() const {
+        return budget;
+    }
+
+    /**
+     * Get the number of shards
+     */
+    size_t getNumShards() const {
+        return shards.size();
+    }
+
+private:
+    /**
+     * Subtract arg from the total unless the total is smaller than arg
+     *
+     * @return true if it was subtracted
+     */
+    bool trySubtract(T arg) const {
+        T expected = value.load(std::memory_order_relaxed);
+        do {
+            if (expected < arg) {
+                return false;
+            }
+        } while (!value.compare_exchange_weak(
+                expected, expected - arg, std::memory_order_relaxed));
+        return true;
+    }
+
+    /**
+     * Fold the deltas of all cores into the total and subtract debt from
+     * it (called with the mutex held, debt is an amount already removed
+     * from a shard).
+     *
+     * The increments of all cores are moved before the decrements are
+     * collected, and the folding is retried once (if the first pass moved
+     * anything), so a decrement made (after a matching increment on
+     * another core) while the shards are visited doesn't cause an
+     * underflow. If the total is still too small the underflow policy is
+     * invoked (without waiting for the other cores to stop updating their
+     * deltas).
+     *
+     * @throws what the underflow policy throws (the decrements collected
+     *         from the cores are put back, and debt isn't subtracted)
+     */
+    void fold(T debt) const {
+        T collected = 0;
+        for (int pass = 0; pass < 2; ++pass) {
+            bool moved = false;
+            for (auto& shard : shards) {
+                const Delta delta = shard.load();
+                if (delta > 0) {
+                    value.fetch_add(T(delta), std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+                    shard.fetch_sub(delta);
+                    moved = true;
+                }
+            }
+            for (auto& shard : shards) {
+                const Delta delta = shard.load();
+                if (delta < 0) {
+                    shard.fetch_sub(delta);
+                    collected += T(-delta);
+                    moved = true;
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (trySubtract(debt + collected)) {
+                return;
+            }
+            if (!moved) {
+                break;
+            }
+        }
+
+        const T arg = debt + collected;
+        T expected = value.load(std::memory_order_relaxed);
+        T desired;
+        try {
+            do {
+                desired = expected - arg;
+                if (expected < arg) {
+                    UnderflowPolicy<T>().underflow(desired);
+                }
+            } while (!value.compare_exchange_weak(
+                    expected, desired, std::memory_order_relaxed));
+        } catch (...) {
+            if (collected != 0) {
+                shards.get(std::nothrow).fetch_sub(Delta(collected));
+            }
+            throw;
+        }
+    }
+
+    const Delta budget;
+    /// The delta of each core which hasn't been moved to the total
+    mutable Shards shards;
+    /// The total
+    mutable std::atomic<T> value;
+    /// Serialises folding the deltas into the total
+    mutable std::mutex mutex;
+};
+
+} // namespace cb
@@ -0,0 +1,146 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/platform.h>
+#include <platform/ring_buffer.h>
+#include <relaxed_atomic.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace cb {
+
+/**
+ * The SlowBlockReporter writes the reports about slow blocks from
+ * GenericBlockTimer without blocking the (already slow) thread which
+ * executed the block.
+ *
+ * report() pushes the report onto a bounded lock-free queue
+ * (cb::MPMCRingBuffer; if the queue is full the report is dropped and
+ * counted). A background thread wakes
+ * up once per interval, aggregates the queued reports per name and writes
+ * a single line for each name seen during the interval (the number of
+ * slow blocks and the slowest one) so the output is rate limited during
+ * a latency storm.
+ */
+class PLATFORM_PUBLIC_API SlowBlockReporter {
+public:
+    /**
+     * Get the process-wide instance (writing to stderr once per second).
+     * The background thread is started the first time it is called.
+     *
+     * The instance is never destroyed (and its thread is detached) so it
+     * may be used until the process terminates; the pending reports are
+     * written by an atexit() handler.
+     */
+    static SlowBlockReporter& instance();
+
+    /**
+     * Create a new reporter and start its background thread
+     *
+     * @param out the stream to write the reports to
+     * @param interval how often to write the aggregated reports
+     * @param capacity the max number of queued reports (rounded up to the
+     *                 next power of two)
+     * @throws std::system_error if the thread could not be started
+     */
+    SlowBlockReporter(std::ostream& out,
+                      std::chrono::milliseconds interval,
+                      size_t capacity = 1024);
+
+    /**
+     * Stop the background thread (writing any pending reports)
+     */
+    ~SlowBlockReporter();
+
+    SlowBlockReporter(const SlowBlockReporter&) = delete;
+    SlowBlockReporter& operator=(const SlowBlockReporter&) = delete;
+
+    /**
+     * Report that a block took too long. Called from the thread executing
+     * the block so it must be cheap; it copies the name (truncated to
+     * MaxNameLength characters) into the queue and returns.
+     *
+     * @param name the name of the block
+     * @param duration the time the block took
+     * @return true if the report was queued, false if it was dropped as
+     *         the queue is full
+     */
+    bool report(const char* name, std::chrono::milliseconds duration);
+
+    /**
+     * Aggregate the queued reports and write them now (instead of
+     * waiting for the next interval)
+     */
+    void flush();
+
+    /**
+     * Get the total number of reports dropped because the queue was full
+     */
+    size_t getDropped() const {
+        return dropped.load();
+    }
+
+    static const size_t MaxNameLength = 47;
+
+private:
+    struct Report {
+        char name[MaxNameLength + 1];
+        uint64_t msec;
+    };
+
+    struct Aggregate {
+        size_t count = 0;
+        uint64_t max = 0;
+    };
+
+    /// Drain the queue and write the aggregates (mutex held)
+    void write();
+
+    /// The main loop for the background thread
+    void run();
+
+    /// Write the pending reports of the process-wide instance at exit
+    static void writeAtExit();
+
+    std::ostream& out;
+    const std::chrono::milliseconds interval;
+
+    // The reports not yet aggregated
+    MPMCRingBuffer<Report> queue;
+
+    Couchbase::RelaxedAtomic<size_t> dropped;
+    // The number of dropped reports when we last wrote them
+    size_t droppedReported = 0;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool stop = false;
+    std::map<std::string, Aggregate> aggregates;
+
+    std::thread thread;
+};
+
+} // namespace cb
@@ -0,0 +1,378 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cJSON_utils.h>
+#include <platform/cacheline_padded.h>
+#include <platform/cb_malloc.h>
+#include <platform/platform.h>
+#include <platform/sized_buffer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+
+namespace cb {
+
+/**
+ * The SpscPipe class is a lock-free variant of cb::Pipe which may be
+ * used by exactly one producer thread and exactly one consumer thread
+ * at the same time (for instance a network thread calling recv() into
+ * the pipe while a worker thread parses data out of it).
+ *
+ * It provides the same produce / consume / rdata / wdata API as cb::Pipe,
+ * but the methods are split between the two ends of the pipe:
+ *
+ *   producer thread: wsize(), wdata(), produce(), produced(), full()
+ *   consumer thread: rsize(), rdata(), consume(), consumed(), empty(), clear()
+ *
+ * Implementation details:
+ *
+ * Unlike cb::Pipe the underlying buffer is used as a ring buffer with
+ * a fixed capacity (rounded up to the next power of two). It may never
+ * be reallocated or packed as that would invalidate the memory the other
+ * end of the pipe may be operating on. The read_head and write_head are
+ * monotonically increasing counters (masked to get the offset in the
+ * buffer), each living in its own cache line so that the producer and
+ * the consumer don't invalidate each others cache lines. Each head is
+ * only written by the thread owning that end of the pipe (with release
+ * semantics), and read by the other end (with acquire semantics).
+ *
+ * As the data may wrap around the end of the buffer the memory area
+ * provided to the callbacks (and returned by rdata() / wdata()) is the
+ * largest _contiguous_ segment available. When that segment is
+ * exhausted the next call returns the segment at the beginning of the
+ * buffer.
+ */
+class SpscPipe {
+public:
+    /**
+     * Initialize a pipe with the given buffer size (default 2k).
+     *
+     * The size is rounded up to the next power of two, and the minimum
+     * size of the buffer is 128 bytes (to match cb::Pipe).
+     *
+     * @param size The requested size of the buffer in the pipe
+     * @throws std::bad_alloc if memory allocation fails
+     */
+    explicit SpscPipe(size_t size = 2048) {
+        size_t allocation_size = 128;
+        while (allocation_size < size) {
+            allocation_size *= 2;
+        }
+        memory.reset(static_cast<uint8_t*>(cb_malloc(allocation_size)));
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        buffer = {memory.get(), allocation_size};
+        mask = allocation_size - 1;
+    }
+
+    SpscPipe(const SpscPipe&) = delete;
+    SpscPipe& operator=(const SpscPipe&) = delete;
+
+    /**
+     * Get the allocation size of the buffer (it never change)
+     */
+    size_t capacity() const {
+        return buffer.size();
+    }
+
+    /**
+     * Read the number of bytes currently available in the read end
+     * of the pipe (may only be called from the consumer)
+     */
+    size_t rsize() const {
+        return write_head->load(std::memory_order_acquire) -
+               read_head->load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the available (contiguous) read buffer (may only be called
+     * from the consumer)
+     */
+    cb::const_byte_buffer rdata() const {
+        return getAvailableReadSpace();
+    }
+
+    /**
+     * Returns the number of bytes available to be written to in the
+     * write end of the pipe (may only be called from the producer). Note
+     * that this space may not be contiguous; see wdata().
+     */
+    size_t wsize() const {
+        return buffer.size() - (write_head->load(std::memory_order_relaxed) -
+                                read_head->load(std::memory_order_acquire));
+    }
+
+    /**
+     * Get the available (contiguous) write buffer (may only be called
+     * from the producer)
+     */
+    cb::byte_buffer wdata() const {
+        return getAvailableWriteSpace();
+    }
+
+    /**
+     * Try to produce a number of bytes by providing a callback function
+     * which will receive the buffer where the data may be inserted
+     *
+     * @param producer a callback function to produce data into the
+     *                 continuous memory area from ptr and size bytes
+     *                 long
+     * @return the number of bytes produced
+     */
+    ssize_t produce(std::function<ssize_t(void* /* ptr */, size_t /* size */)>
+                            producer) {
+        return produce<decltype(producer)&>(producer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Producer>
+    auto produce(Producer&& producer) -> decltype(
+            ssize_t(producer(static_cast<void*>(nullptr), size_t(0)))) {
+        auto avail = getAvailableWriteSpace();
+
+        const ssize_t ret =
+                producer(static_cast<void*>(avail.data()), avail.size());
+
+        if (ret > 0) {
+            produced(ret);
+        }
+
+        return ret;
+    }
+
+    /**
+     * Try to produce a number of bytes by providing a callback function
+     * which will receive the buffer where the data may be inserted
+     *
+     * @param producer a callback function to produce data into the
+     *                 provided buffer.
+     * @return the number of bytes produced
+     */
+    ssize_t produce(std::function<ssize_t(cb::byte_buffer)> producer) {
+        return produce<decltype(producer)&>(producer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Producer>
+    auto produce(Producer&& producer)
+            -> decltype(ssize_t(producer(cb::byte_buffer{}))) {
+        auto avail = getAvailableWriteSpace();
+
+        const ssize_t ret = producer({avail.data(), avail.size()});
+
+        if (ret > 0) {
+            produced(ret);
+        }
+
+        return ret;
+    }
+
+    /**
+     * A number of bytes was made available for the consumer. The bytes
+     * are published to the consumer with release semantics.
+     */
+    void produced(size_t nbytes) {
+        const auto wh = write_head->load(std::memory_order_relaxed);
+        if (nbytes > getAvailableWriteSpace().size()) {
+            throw std::logic_error(
+                    "SpscPipe::produced(): Produced bytes exceeds "
+                    "the number of available bytes");
+        }
+        write_head->store(wh + nbytes, std::memory_order_release);
+    }
+
+    /**
+     * Try to consume data from the buffer by providing a callback function
+     *
+     * @param producer a callback function to consume data from the provided
+     *                 continuous memory area from ptr and size bytes long.
+     *                 The number of bytes consumed should be returned.
+     * @return the number of bytes consumed
+     */
+    ssize_t consume(std::function<ssize_t(const void* /* ptr */,
+                                          size_t /* size */)> consumer) {
+        return consume<decltype(consumer)&>(consumer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Consumer>
+    auto consume(Consumer&& consumer)
+            -> decltype(ssize_t(consumer(static_cast<const void*>(nullptr),
+                                         size_t(0)))) {
+        auto avail = getAvailableReadSpace();
+        const ssize_t ret =
+                consumer(static_cast<const void*>(avail.data()), avail.size());
+        if (ret > 0) {
+            consumed(ret);
+        }
+        return ret;
+    }
+
+    /**
+     * Try to consume data from the buffer by providing a callback function
+     *
+     * @param producer a callback function to consume data from the provided
+     *                 memory area. The number of bytes consumed should be
+     *                 returned.
+     * @return the number of bytes consumed
+     */
+    ssize_t consume(std::function<ssize_t(cb::const_byte_buffer)> consumer) {
+        return consume<decltype(consumer)&>(consumer);
+    }
+
+    /**
+     * Same as above, but the callback is a template parameter so that it
+     * may be inlined (and a capturing lambda doesn't have to be wrapped in
+     * a std::function, which may allocate memory).
+     */
+    template <typename Consumer>
+    auto consume(Consumer&& consumer)
+            -> decltype(ssize_t(consumer(cb::const_byte_buffer{}))) {
+        auto avail = getAvailableReadSpace();
+        const ssize_t ret = consumer({avail.data(), avail.size()});
+        if (ret > 0) {
+            consumed(ret);
+        }
+        return ret;
+    }
+
+    /**
+     * The number of bytes just removed from the consumer end of the buffer.
+     * The space is handed back to the producer with release semantics
+     * (so the consumer must be done accessing it).
+     */
+    void consumed(size_t nbytes) {
+        const auto rh = read_head->load(std::memory_order_relaxed);
+        if (nbytes > getAvailableReadSpace().size()) {
+            throw std::logic_error(
+                    "SpscPipe::consumed(): Consumed bytes exceeds "
+                    "the number of available bytes");
+        }
+        read_head->store(rh + nbytes, std::memory_order_release);
+    }
+
+    /**
+     * Is this buffer empty (the consumer end completely caught up with
+     * the producer). From the producer side the answer may be stale
+     * by the time the method returns.
+     */
+    bool empty() const {
+        return read_head->load(std::memory_order_acquire) ==
+               write_head->load(std::memory_order_acquire);
+    }
+
+    /**
+     * Is this buffer full or not. From the consumer side the answer
+     * may be stale by the time the method returns.
+     */
+    bool full() const {
+        return write_head->load(std::memory_order_acquire) -
+                       read_head->load(std::memory_order_acquire) ==
+               buffer.size();
+    }
+
+    /**
+     * Drop all of the content currently available in the buffer (may only
+     * be called from the consumer)
+     */
+    void clear() {
+        read_head->store(write_head->load(std::memory_order_acquire),
+                         std::memory_order_release);
+    }
+
+    /**
+     * Get the (internal) properties of the pipe
+     */
+    unique_cJSON_ptr to_json() const {
+        unique_cJSON_ptr ret(cJSON_CreateObject());
+        cJSON_AddUintPtrToObject(ret.get(), "buffer", uintptr_t(buffer.data()));
+        cJSON_AddNumberToObject(ret.get(), "size", buffer.size());
+        cJSON_AddNumberToObject(
+                ret.get(), "read_head", read_head->load() & mask);
+        cJSON_AddNumberToObject(
+                ret.get(), "write_head", write_head->load() & mask);
+        cJSON_AddBoolToObject(ret.get(), "empty", empty());
+        return ret;
+    }
+
+protected:
+    /**
+     * Get information of the _unused_ contiguous space in the write end
+     * of the pipe.
+     */
+    cb::byte_buffer getAvailableWriteSpace() const {
+        const auto wh = write_head->load(std::memory_order_relaxed);
+        const auto rh = read_head->load(std::memory_order_acquire);
+        const size_t offset = wh & mask;
+        const size_t avail = buffer.size() - (wh - rh);
+        return {const_cast<uint8_t*>(buffer.data()) + offset,
+                std::min(avail, buffer.size() - offset)};
+    }
+
+    /**
+     * Get information of the contiguous data the consumer may read.
+     */
+    cb::const_byte_buffer getAvailableReadSpace() const {
+        const auto rh = read_head->load(std::memory_order_relaxed);
+        const auto wh = write_head->load(std::memory_order_acquire);
+        const size_t offset = rh & mask;
+        return {buffer.data() + offset,
+                std::min(wh - rh, buffer.size() - offset)};
+    }
+
+    // The information about the underlying buffer
+    cb::byte_buffer buffer;
+
+    // The mask to apply to the heads to get the offset in the buffer
+    size_t mask;
+
+    struct cb_malloc_deleter {
+        void operator()(uint8_t* ptr) {
+            cb_free(static_cast<void*>(ptr));
+        }
+    };
+    std::unique_ptr<uint8_t, cb_malloc_deleter> memory;
+
+    // The total number of bytes written to the pipe (only modified by
+    // the producer)
+    cb::CachelinePadded<std::atomic<size_t>> write_head{0};
+
+    // The total number of bytes read from the pipe (only modified by
+    // the consumer)
+    cb::CachelinePadded<std::atomic<size_t>> read_head{0};
+};
+
+} // namespace cb
@@ -18,6 +18,13 @@
 
 #include <platform/platform.h>
 
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#ifdef HAVE_RSEQ
+#include <sys/rseq.h>
+#endif
+
 namespace cb {
 
 /**
@@ -50,6 +57,66 @@ size_t get_cpu_count();
  */
 PLATFORM_PUBLIC_API
 size_t get_cpu_index();
+
+/**
+ * Get the NUMA node the given CPU belongs to
+ *
+ * @param cpu the CPU (as returned by get_cpu_index())
+ * @return the node of the CPU (0 if the system doesn't have multiple
+ *         NUMA nodes or the node can't be determined)
+ */
+PLATFORM_PUBLIC_API
+size_t get_numa_node(size_t cpu);
+
+namespace detail {
+/**
+ * Read the current CPU from the restartable sequences (rseq) area glibc
+ * registered for the thread (the kernel keeps the cpu_id field up to date
+ * with the CPU the thread runs on).
+ *
+ * @return the CPU or -1 if glibc didn't register an area
+ */
+inline int get_rseq_cpu_id() noexcept {
+#ifdef HAVE_RSEQ
+    if (__rseq_size > 0) {
+        const auto* area = reinterpret_cast<const volatile struct rseq*>(
+                static_cast<char*>(__builtin_thread_pointer()) +
+                __rseq_offset);
+        const int32_t cpu = area->cpu_id;
+        if (cpu >= 0) {
+            return cpu;
+        }
+    }
+#endif
+    return -1;
+}
+
+/**
+ * Get the current CPU of the caller without using rseq (the slow path
+ * of get_cpu_index(std::nothrow_t))
+ */
+PLATFORM_PUBLIC_API
+size_t get_cpu_index_fallback() noexcept;
+} // namespace detail
+
+/**
+ * Get the current CPU of the caller without throwing (for callers which
+ * only use the CPU as a hint, e.g. to pick a shard).
+ *
+ * When glibc has registered a restartable sequences (rseq) area for the
+ * thread, the kernel keeps the current CPU in it, and reading it is an
+ * inline load. Otherwise the CPU is read from sched_getcpu() (which uses
+ * the vDSO getcpu()) or the platform equivalent.
+ *
+ * @return the current CPU of the caller (or 0 if it can't be determined)
+ */
+inline size_t get_cpu_index(std::nothrow_t) noexcept {
+    const int cpu = detail::get_rseq_cpu_id();
+    if (cpu >= 0) {
+        return size_t(cpu);
+    }
+    return detail::get_cpu_index_fallback();
+}
 }
 
 // For backwards compatibility
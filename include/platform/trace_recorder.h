@@ -0,0 +1,246 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <cJSON_utils.h>
+#include <platform/platform.h>
+#include <platform/processclock.h>
+#include <platform/string.h>
+#include <relaxed_atomic.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cb {
+
+/**
+ * A single event recorded by the TraceRecorder
+ */
+struct TraceEvent {
+    /// When the event was recorded (ns since the ProcessClock epoch)
+    uint64_t timestamp;
+    /// The thread which recorded the event (the index of the thread in the
+    /// order the threads started recording in the recorder)
+    uint32_t thread;
+    /// The (user defined) id of the event
+    uint32_t id;
+    /// Two (user defined) payload words
+    uint64_t payload[2];
+};
+
+/**
+ * A fixed size ring of events written by a single thread. When the ring is
+ * full the oldest event is overwritten.
+ *
+ * The capacity is a power of two so the slot is found by masking the
+ * position (instead of the modulo used by cb::RingBuffer). Each slot
+ * carries a sequence number (odd while the slot is being written) so that
+ * other threads may take a snapshot of the ring without locking the
+ * writer; events overwritten while they are being copied are skipped.
+ */
+class PLATFORM_PUBLIC_API TraceRing {
+public:
+    /**
+     * @param capacity the number of events to keep (rounded up to the
+     *                 next power of two)
+     */
+    explicit TraceRing(size_t capacity);
+
+    /**
+     * Record an event (must only be called by the thread owning the ring)
+     */
+    void record(uint64_t timestamp, uint32_t id, uint64_t a, uint64_t b) {
+        const uint64_t pos = head.load(std::memory_order_relaxed);
+        Slot& slot = slots[pos & mask];
+        slot.sequence.store(2 * pos + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.timestamp.store(timestamp, std::memory_order_relaxed);
+        slot.id.store(id, std::memory_order_relaxed);
+        slot.payload[0].store(a, std::memory_order_relaxed);
+        slot.payload[1].store(b, std::memory_order_relaxed);
+        slot.sequence.store(2 * pos + 2, std::memory_order_release);
+        head.store(pos + 1, std::memory_order_release);
+    }
+
+    /**
+     * Copy the events currently in the ring (oldest first) to the end of
+     * the provided vector.
+     *
+     * @param thread the thread index to put in the events
+     * @param out where to store the events
+     */
+    void snapshot(uint32_t thread, std::vector<TraceEvent>& out) const;
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<uint64_t> timestamp{0};
+        std::atomic<uint32_t> id{0};
+        std::atomic<uint64_t> payload[2];
+    };
+
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> head{0};
+};
+
+/**
+ * The TraceRecorder is a flight recorder of events for all of the threads
+ * in the process. Each thread records into its own TraceRing (created the
+ * first time the thread records an event) so recording doesn't take any
+ * locks; it reads the clock and writes the event into the ring of the
+ * calling thread. Callers which already know the time may pass it in to
+ * avoid reading the clock again.
+ *
+ * When something interesting happens (e.g. a latency spike) snapshot() or
+ * to_json() may be used to dump the recent events of all threads, merged
+ * in the order they were recorded:
+ *
+ *     cb::TraceRecorder::instance().record(EventId::FlushStart, vbid);
+ *     ...
+ *     std::cerr << to_string(cb::TraceRecorder::instance().to_json());
+ *
+ * The ring of a thread is kept until the recorder is destroyed (so the
+ * memory used grows with the number of threads which ever recorded
+ * an event; eventsPerThread * 40 bytes per thread).
+ */
+class PLATFORM_PUBLIC_API TraceRecorder {
+public:
+    /**
+     * Get the process-wide instance
+     */
+    static TraceRecorder& instance();
+
+    /**
+     * @param eventsPerThread the number of events kept for each thread
+     *                        (rounded up to the next power of two)
+     */
+    explicit TraceRecorder(size_t eventsPerThread = 1024);
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    /**
+     * Record an event in the ring of the calling thread.
+     *
+     * @param id the id of the event
+     * @param a first payload word
+     * @param b second payload word
+     */
+    void record(uint32_t id, uint64_t a = 0, uint64_t b = 0);
+
+    /**
+     * Record an event with a timestamp provided by the caller.
+     *
+     * Reading the clock is the most expensive part of recording an event,
+     * so callers which already have the time (e.g. the start or end of
+     * an operation they're timing) should pass it in. The events are
+     * sorted by timestamp when they're read, so the timestamp doesn't
+     * need to be increasing.
+     *
+     * @param timestamp when the event happened
+     * @param id the id of the event
+     * @param a first payload word
+     * @param b second payload word
+     */
+    void record(ProcessClock::time_point timestamp,
+                uint32_t id,
+                uint64_t a = 0,
+                uint64_t b = 0);
+
+    /**
+     * Get a copy of the events from all threads sorted by timestamp
+     */
+    std::vector<TraceEvent> snapshot() const;
+
+    /**
+     * Enable (or disable) recording of events
+     */
+    void setEnabled(bool enable) {
+        enabled.store(enable);
+    }
+
+    bool isEnabled() const {
+        return enabled.load();
+    }
+
+    /**
+     * Get the number of threads which have recorded events
+     */
+    size_t getNumThreads() const;
+
+    /**
+     * Get a JSON representation of the events from all threads sorted by
+     * timestamp:
+     *
+     *     {
+     *       "start": "<timestamp of the first event (ns)>",
+     *       "events": [
+     *         {"ts": <ns since start>, "thread": <index>, "id": <id>,
+     *          "a": "0x...", "b": "0x..."},
+     *         ...
+     *       ]
+     *     }
+     */
+    unique_cJSON_ptr to_json() const {
+        const auto events = snapshot();
+        const uint64_t start = events.empty() ? 0 : events.front().timestamp;
+
+        unique_cJSON_ptr ret(cJSON_CreateObject());
+        cJSON_AddStringToObject(
+                ret.get(), "start", std::to_string(start).c_str());
+        cJSON* array = cJSON_CreateArray();
+        for (const auto& event : events) {
+            cJSON* obj = cJSON_CreateObject();
+            cJSON_AddNumberToObject(obj, "ts", double(event.timestamp - start));
+            cJSON_AddNumberToObject(obj, "thread", event.thread);
+            cJSON_AddNumberToObject(obj, "id", event.id);
+            cJSON_AddStringToObject(
+                    obj, "a", cb::to_hex(event.payload[0]).c_str());
+            cJSON_AddStringToObject(
+                    obj, "b", cb::to_hex(event.payload[1]).c_str());
+            cJSON_AddItemToArray(array, obj);
+        }
+        cJSON_AddItemToObject(ret.get(), "events", array);
+        return ret;
+    }
+
+private:
+    /// Get the ring for the calling thread (creating it if needed)
+    TraceRing& getRing();
+
+    /// Identifies this recorder in the thread local cache of the rings
+    const uint64_t uid;
+    const size_t eventsPerThread;
+    Couchbase::RelaxedAtomic<bool> enabled{true};
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+    std::unordered_map<std::thread::id, TraceRing*> threadRings;
+};
+
+} // namespace cb
@@ -0,0 +1,248 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include <platform/loglinear_histogram.h>
+#include <platform/processclock.h>
+#include <platform/ring_buffer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+namespace cb {
+
+/**
+ * A histogram of the values recorded in a sliding time window (e.g. the
+ * last 60 seconds) instead of since the histogram was created / reset.
+ *
+ * The window is split into a number of intervals, each with its own
+ * LogLinearHistogram kept in a RingBufferVector. Values are recorded in
+ * the histogram for the current interval, and tick() rotates the ring
+ * when the interval has passed (resetting the oldest histogram in place
+ * and making it the current one). Queries merge the histograms of the
+ * intervals inside the requested window.
+ *
+ * Each interval has its own counter array, so the memory used is the
+ * size of one LogLinearHistogram times the number of intervals. With 2
+ * significant digits a histogram uses ~14kB for values up to 10^6 and
+ * ~58kB for the full range of a 64 bit value, so 61 intervals use ~850kB
+ * and ~3.6MB respectively. The range and precision must therefore be
+ * provided explicitly.
+ *
+ * add() is a load of the pointer to the current histogram followed by a
+ * relaxed increment of a counter, and may be called from any thread.
+ * tick() and the queries are serialised by a mutex. Nothing rotates the
+ * ring unless tick() (or a query) is called, so someone should call
+ * tick() at least once per interval (e.g. from a timer task) if
+ * recording values in a histogram not being queried.
+ *
+ *     // p99 over the last minute with a resolution of 1 second (the
+ *     // current interval and the 60 complete intervals before it)
+ *     cb::MicrosecondWindowedHistogram histogram(
+ *             std::chrono::seconds(1), 61, std::chrono::seconds(10), 2);
+ *     ...
+ *     histogram.add(duration);
+ *     ...
+ *     auto p99 = histogram.percentile(99, std::chrono::seconds(60));
+ */
+template <typename T, template <class> class Limits = std::numeric_limits>
+class WindowedHistogram {
+public:
+    using histogram_type = LogLinearHistogram<T, Limits>;
+
+    /**
+     * Build a windowed histogram.
+     *
+     * @param interval the duration of each interval
+     * @param numIntervals the number of intervals kept (the max window is
+     *                     numIntervals - 1 complete intervals plus the
+     *                     current one)
+     * @param highestTrackableValue see LogLinearHistogram
+     * @param significantDigits see LogLinearHistogram
+     * @param clockSource the source of the current time
+     * @throws std::invalid_argument for an invalid configuration
+     */
+    WindowedHistogram(ProcessClock::duration interval,
+                      size_t numIntervals,
+                      T highestTrackableValue,
+                      int significantDigits,
+                      ProcessClockSource& clockSource =
+                              cb::defaultProcessClockSource())
+        : clockSource(clockSource),
+          interval(interval),
+          slots(numIntervals) {
+        if (interval <= ProcessClock::duration::zero()) {
+            throw std::invalid_argument(
+                    "WindowedHistogram: interval must be positive");
+        }
+        if (numIntervals == 0) {
+            throw std::invalid_argument(
+                    "WindowedHistogram: numIntervals must be non-zero");
+        }
+        for (auto& slot : slots) {
+            slot = histogram_type(highestTrackableValue, significantDigits);
+        }
+        current.store(&slots.back());
+        currentStart = clockSource.now();
+    }
+
+    WindowedHistogram(const WindowedHistogram&) = delete;
+    WindowedHistogram& operator=(const WindowedHistogram&) = delete;
+
+    /**
+     * Add a value to the histogram for the current interval.
+     *
+     * @param amount the size of the thing being added
+     * @param count the quantity at this size being added
+     */
+    void add(T amount, size_t count = 1) {
+        current.load(std::memory_order_acquire)->add(amount, count);
+    }
+
+    /**
+     * Add a batch of values to the histogram for the current interval
+     * (see LogLinearHistogram::add).
+     */
+    void add(cb::sized_buffer<const T> values) {
+        current.load(std::memory_order_acquire)->add(values);
+    }
+
+    /**
+     * Rotate the intervals if the current interval has passed.
+     */
+    void tick() {
+        std::lock_guard<std::mutex> guard(mutex);
+        rotate();
+    }
+
+    /**
+     * Get a histogram of the values recorded in the given window.
+     *
+     * The current interval is only partially complete, so the histogram
+     * merges the current interval and enough complete intervals before it
+     * to cover the window (the window is rounded up to a multiple of the
+     * interval). A window of 0 returns the current interval only.
+     *
+     * @param window the duration of the window (limited to the
+     *               numIntervals - 1 complete intervals kept)
+     */
+    histogram_type getWindow(ProcessClock::duration window) {
+        std::lock_guard<std::mutex> guard(mutex);
+        rotate();
+
+        size_t count = 1;
+        if (window > ProcessClock::duration::zero()) {
+            count += size_t((window + interval - ProcessClock::duration(1)) /
+                            interval);
+        }
+        count = std::min(count, slots.size());
+
+        // The newest slot is at the back of the ring
+        auto ret = slots.back().snapshot();
+        for (size_t ii = slots.size() - count; ii < slots.size() - 1; ++ii) {
+            ret.merge(slots[ii]);
+        }
+        return ret;
+    }
+
+    /**
+     * Get a histogram of all of the values recorded in the intervals kept.
+     */
+    histogram_type getWindow() {
+        return getWindow(interval * (slots.size() - 1));
+    }
+
+    /**
+     * Get the value at the given percentile of the values recorded in the
+     * given window (see getWindow and LogLinearHistogram::percentile).
+     */
+    T percentile(double percentile, ProcessClock::duration window) {
+        return getWindow(window).percentile(percentile);
+    }
+
+    /**
+     * Get the number of values recorded in the given window.
+     */
+    size_t total(ProcessClock::duration window) {
+        return getWindow(window).total();
+    }
+
+    /**
+     * Clear all intervals.
+     */
+    void reset() {
+        std::lock_guard<std::mutex> guard(mutex);
+        for (auto& slot : slots) {
+            slot.reset();
+        }
+    }
+
+    ProcessClock::duration getInterval() const {
+        return interval;
+    }
+
+    size_t getNumIntervals() const {
+        return slots.size();
+    }
+
+    /**
+     * Get the number of bytes used by the counters of all intervals
+     */
+    size_t getMemoryUsage() const {
+        return slots.back().getLayout().size() * sizeof(size_t) *
+               slots.size();
+    }
+
+private:
+    /// Rotate the ring for the intervals passed since the last rotation
+    /// (called with the mutex held)
+    void rotate() {
+        const auto elapsed = (clockSource.now() - currentStart) / interval;
+        if (elapsed <= 0) {
+            return;
+        }
+
+        // If more intervals than we keep have passed, they're all empty
+        const auto count = std::min(size_t(elapsed), slots.size());
+        for (size_t ii = 0; ii < count; ++ii) {
+            slots.rotate().reset();
+        }
+        current.store(&slots.back(), std::memory_order_release);
+        currentStart += interval * elapsed;
+    }
+
+    ProcessClockSource& clockSource;
+    const ProcessClock::duration interval;
+
+    // Protects the ring and currentStart
+    std::mutex mutex;
+    RingBufferVector<histogram_type> slots;
+    ProcessClock::time_point currentStart;
+
+    // The histogram for the current interval (the back of the ring)
+    std::atomic<histogram_type*> current{nullptr};
+};
+
+/**
+ * WindowedHistogram of durations measured in microseconds.
+ */
+using MicrosecondWindowedHistogram =
+        WindowedHistogram<UnsignedMicroseconds, cb::duration_limits>;
+
+} // namespace cb
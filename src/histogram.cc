@@ -17,6 +17,8 @@
 
 #include <platform/histogram.h>
 
+#include "histogram_encoding.h"
+
 /*
  * Histogram<> definitions of large methods which we prefer to not inline.
  */
@@ -26,6 +28,38 @@ void Histogram<T, Limits>::add(T amount, size_t count) {
     (*findBin(amount))->incr(count);
 }
 
+template <typename T, template <class> class Limits>
+void Histogram<T, Limits>::add(cb::sized_buffer<const T> values) {
+    // Search a contiguous copy of the bin boundaries (instead of following
+    // the pointer to each bin) using a branch free binary search.
+    // ends[ii] is the end of bin ii, and the last bin accepts any value.
+    std::vector<T> ends;
+    ends.reserve(bins.size());
+    for (const auto& bin : bins) {
+        ends.push_back(bin->end());
+    }
+    ends.back() = Limits<T>::max();
+
+    std::vector<size_t> counts(bins.size());
+    for (const auto& value : values) {
+        // Find the first bin with an end greater than value (or the last)
+        const T* base = ends.data();
+        size_t n = ends.size();
+        while (n > 1) {
+            const size_t half = n / 2;
+            base = (base[half - 1] <= value) ? base + half : base;
+            n -= half;
+        }
+        ++counts[base - ends.data()];
+    }
+
+    for (size_t ii = 0; ii < bins.size(); ++ii) {
+        if (counts[ii] != 0) {
+            bins[ii]->incr(counts[ii]);
+        }
+    }
+}
+
 template <typename T, template <class> class Limits>
 void Histogram<T, Limits>::reset() {
     std::for_each(bins.begin(), bins.end(),
@@ -38,6 +72,129 @@ size_t Histogram<T, Limits>::total() {
     return std::accumulate(begin(), end(), 0, a);
 }
 
+template <typename T, template <class> class Limits>
+T Histogram<T, Limits>::percentile(double percentile) const {
+    return cb::getHistogramPercentile<T, Limits>(begin(), end(), percentile);
+}
+
+template <typename T, template <class> class Limits>
+void Histogram<T, Limits>::merge(const Histogram& other) {
+    if (bins.size() != other.bins.size()) {
+        throw std::invalid_argument(
+                "Histogram::merge: can't merge histograms with a different "
+                "number of bins");
+    }
+    for (size_t ii = 0; ii < bins.size(); ++ii) {
+        if (bins[ii]->start() != other.bins[ii]->start() ||
+            bins[ii]->end() != other.bins[ii]->end()) {
+            throw std::invalid_argument(
+                    "Histogram::merge: can't merge histograms with "
+                    "different bins");
+        }
+    }
+    for (size_t ii = 0; ii < bins.size(); ++ii) {
+        bins[ii]->incr(other.bins[ii]->count());
+    }
+}
+
+template <typename T, template <class> class Limits>
+Histogram<T, Limits> Histogram<T, Limits>::snapshot() const {
+    container_type copy;
+    copy.reserve(bins.size());
+    for (const auto& bin : bins) {
+        copy.push_back(std::make_unique<bin_type>(bin->start(), bin->end()));
+        copy.back()->set(bin->count());
+    }
+    return Histogram(std::move(copy));
+}
+
+template <typename T, template <class> class Limits>
+Histogram<T, Limits> Histogram<T, Limits>::drain() {
+    container_type copy;
+    copy.reserve(bins.size());
+    for (const auto& bin : bins) {
+        copy.push_back(std::make_unique<bin_type>(bin->start(), bin->end()));
+        copy.back()->set(bin->exchange(0));
+    }
+    return Histogram(std::move(copy));
+}
+
+template <typename T, template <class> class Limits>
+std::vector<uint8_t> Histogram<T, Limits>::encode() const {
+    using namespace cb::histogram_encoding;
+    std::vector<uint8_t> ret;
+    ret.push_back(uint8_t(Format::Histogram));
+
+    // The first bin always starts at Limits::min() and the last bin ends
+    // at Limits::max(); so only the start of the following bins needs to
+    // be stored. The values are unsigned 64 bit deltas (which also works
+    // for signed types as the bins are sorted).
+    encodeVarint(bins.size(), ret);
+    uint64_t prev = uint64_t(bins.front()->start() / T(1));
+    for (auto it = bins.begin() + 1; it != bins.end(); ++it) {
+        const auto start = uint64_t((*it)->start() / T(1));
+        encodeVarint(start - prev, ret);
+        prev = start;
+    }
+
+    encodeCounts(bins.begin(), bins.end(), ret);
+    return ret;
+}
+
+template <typename T, template <class> class Limits>
+Histogram<T, Limits> Histogram<T, Limits>::decode(
+        cb::const_byte_buffer encoded) {
+    using namespace cb::histogram_encoding;
+    // Dividing two durations returns a value of the underlying Rep.
+    using rep_type = decltype(T(1) / T(1));
+
+    if (encoded.empty() || encoded[0] != uint8_t(Format::Histogram)) {
+        throw std::invalid_argument(
+                "Histogram::decode: input is not an encoded Histogram");
+    }
+    encoded = {encoded.data() + 1, encoded.size() - 1};
+
+    const auto numBins = decodeVarint(encoded);
+    if (numBins == 0 || numBins > encoded.size() + 1) {
+        throw std::invalid_argument(
+                "Histogram::decode: invalid number of bins");
+    }
+
+    std::vector<T> starts;
+    starts.reserve(numBins);
+    starts.push_back(Limits<T>::min());
+    uint64_t prev = uint64_t(Limits<T>::min() / T(1));
+    for (uint64_t ii = 1; ii < numBins; ++ii) {
+        const uint64_t delta = decodeVarint(encoded);
+        const uint64_t raw = prev + delta;
+        const auto start = static_cast<T>(rep_type(raw));
+        if (delta == 0 || uint64_t(start / T(1)) != raw ||
+            start <= starts.back() || start >= Limits<T>::max()) {
+            throw std::invalid_argument(
+                    "Histogram::decode: invalid bin boundaries");
+        }
+        starts.push_back(start);
+        prev = raw;
+    }
+
+    container_type decoded;
+    decoded.reserve(numBins);
+    for (size_t ii = 0; ii < starts.size(); ++ii) {
+        const T end = (ii + 1 < starts.size()) ? starts[ii + 1]
+                                               : Limits<T>::max();
+        decoded.push_back(std::make_unique<bin_type>(starts[ii], end));
+    }
+
+    decodeCounts(encoded, decoded.size(), [&decoded](size_t idx, size_t n) {
+        decoded[idx]->set(n);
+    });
+    if (!encoded.empty()) {
+        throw std::invalid_argument(
+                "Histogram::decode: unexpected data after the histogram");
+    }
+    return Histogram(std::move(decoded));
+}
+
 template <typename T, template <class> class Limits>
 bool Histogram<T, Limits>::verify() {
     T prev = Limits<T>::min();
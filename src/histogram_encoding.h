@@ -0,0 +1,159 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+//
+// histogram_encoding - helper functions used by the histogram classes
+// to encode / decode the binary representation of a histogram.
+//
+// All integers are stored as unsigned LEB128 varints (7 bits per byte,
+// least significant group first, the high bit set on all but the last
+// byte). The counts of a histogram are stored as:
+//
+//     varint  number of non-zero bins
+//     for each non-zero bin:
+//         varint  distance from the previous non-zero bin index (the first
+//                 index is relative to 0)
+//         varint  zigzag encoded difference from the previous non-zero
+//                 count (the first count is relative to 0)
+//
+
+#pragma once
+
+#include <platform/sized_buffer.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace cb {
+namespace histogram_encoding {
+
+/// The first byte of an encoded histogram identifies the format
+enum class Format : uint8_t { Histogram = 1, LogLinearHistogram = 2 };
+
+/// Encode a value as a varint and append it to out
+inline void encodeVarint(uint64_t value, std::vector<uint8_t>& out) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+/**
+ * Decode a varint from the beginning of the input and move the input past
+ * the decoded bytes.
+ *
+ * @throws std::invalid_argument if the input is truncated or the value
+ *                               doesn't fit in 64 bits
+ */
+inline uint64_t decodeVarint(cb::const_byte_buffer& in) {
+    uint64_t ret = 0;
+    for (size_t ii = 0; ii < in.size(); ++ii) {
+        const uint64_t byte = in.data()[ii];
+        const auto shift = 7 * ii;
+        if (shift > 63 || (shift == 63 && (byte & 0x7e) != 0)) {
+            throw std::invalid_argument(
+                    "histogram_encoding::decodeVarint: value too large");
+        }
+        ret |= (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            in = {in.data() + ii + 1, in.size() - ii - 1};
+            return ret;
+        }
+    }
+    throw std::invalid_argument(
+            "histogram_encoding::decodeVarint: truncated input");
+}
+
+/// Map signed values to unsigned so small magnitudes get small encodings
+inline uint64_t zigzagEncode(int64_t value) {
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+inline int64_t zigzagDecode(uint64_t value) {
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+/**
+ * Encode the counts of the bins in [begin, end) (skipping the empty
+ * bins) and append them to out.
+ *
+ * @param begin iterator to the first bin (dereferencing the iterator must
+ *              provide ->count())
+ * @param end iterator past the last bin
+ * @param out where to append the encoded counts
+ */
+template <typename Iterator>
+void encodeCounts(Iterator begin, Iterator end, std::vector<uint8_t>& out) {
+    // Read every count once so that the number of non-zero bins matches
+    // the bins written if other threads are adding values
+    std::vector<std::pair<uint64_t, uint64_t>> nonzero;
+    uint64_t index = 0;
+    for (auto it = begin; it != end; ++it, ++index) {
+        const uint64_t count = (*it)->count();
+        if (count != 0) {
+            nonzero.emplace_back(index, count);
+        }
+    }
+
+    encodeVarint(nonzero.size(), out);
+    uint64_t prevIndex = 0;
+    uint64_t prevCount = 0;
+    for (const auto& entry : nonzero) {
+        encodeVarint(entry.first - prevIndex, out);
+        encodeVarint(zigzagEncode(int64_t(entry.second - prevCount)), out);
+        prevIndex = entry.first;
+        prevCount = entry.second;
+    }
+}
+
+/**
+ * Decode counts encoded by encodeCounts from the beginning of the input
+ * (and move the input past the decoded bytes).
+ *
+ * @param in the input to decode
+ * @param numBins the number of bins in the histogram being decoded
+ * @param callback called with the index and count for each non-zero bin
+ * @throws std::invalid_argument if the input is invalid
+ */
+template <typename Callback>
+void decodeCounts(cb::const_byte_buffer& in,
+                  size_t numBins,
+                  Callback callback) {
+    const auto numNonZero = decodeVarint(in);
+    if (numNonZero > numBins) {
+        throw std::invalid_argument(
+                "histogram_encoding::decodeCounts: too many bins");
+    }
+    uint64_t index = 0;
+    uint64_t count = 0;
+    for (uint64_t ii = 0; ii < numNonZero; ++ii) {
+        const auto delta = decodeVarint(in);
+        if ((ii != 0 && delta == 0) || delta >= numBins - index) {
+            throw std::invalid_argument(
+                    "histogram_encoding::decodeCounts: invalid bin index");
+        }
+        index += delta;
+        count += uint64_t(zigzagDecode(decodeVarint(in)));
+        callback(size_t(index), size_t(count));
+    }
+}
+
+} // namespace histogram_encoding
+} // namespace cb
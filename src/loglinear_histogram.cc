@@ -0,0 +1,257 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/loglinear_histogram.h>
+
+#include "histogram_encoding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+cb::LogLinearLayout::LogLinearLayout(uint64_t highestTrackableValue,
+                                     int significantDigits)
+    : highestTrackableValue(highestTrackableValue),
+      significantDigits(significantDigits) {
+    if (significantDigits < 1 || significantDigits > 5) {
+        throw std::invalid_argument(
+                "LogLinearLayout: significantDigits must be in the range "
+                "[1, 5]");
+    }
+    if (highestTrackableValue < 2) {
+        throw std::invalid_argument(
+                "LogLinearLayout: highestTrackableValue must be >= 2");
+    }
+
+    // We need 2 * 10^digits sub-buckets in each bucket to have the
+    // requested precision (rounded up to the next power of two).
+    const uint64_t largestValueWithSingleUnitResolution =
+            2 * uint64_t(std::pow(10, significantDigits));
+    size_t subBucketCount = 1;
+    int subBucketCountMagnitude = 0;
+    while (subBucketCount < largestValueWithSingleUnitResolution) {
+        subBucketCount <<= 1;
+        ++subBucketCountMagnitude;
+    }
+    subBucketHalfCountMagnitude = subBucketCountMagnitude - 1;
+    subBucketHalfCount = subBucketCount / 2;
+    subBucketMask = uint64_t(subBucketCount - 1);
+
+    // Find the number of buckets needed to cover the highest trackable
+    // value
+    uint64_t smallestUntrackableValue = subBucketCount;
+    size_t bucketCount = 1;
+    while (smallestUntrackableValue <= highestTrackableValue) {
+        if (smallestUntrackableValue >
+            std::numeric_limits<uint64_t>::max() / 2) {
+            ++bucketCount;
+            break;
+        }
+        smallestUntrackableValue <<= 1;
+        ++bucketCount;
+    }
+    countsLength = (bucketCount + 1) * subBucketHalfCount;
+}
+
+uint64_t cb::LogLinearLayout::lowestEquivalentValue(size_t index) const {
+    int bucketIndex = int(index >> subBucketHalfCountMagnitude) - 1;
+    uint64_t subBucketIndex = (index & (subBucketHalfCount - 1)) +
+                              subBucketHalfCount;
+    if (bucketIndex < 0) {
+        subBucketIndex -= subBucketHalfCount;
+        bucketIndex = 0;
+    }
+    return subBucketIndex << bucketIndex;
+}
+
+uint64_t cb::LogLinearLayout::nextNonEquivalentValue(size_t index) const {
+    int bucketIndex = int(index >> subBucketHalfCountMagnitude) - 1;
+    if (bucketIndex < 0) {
+        bucketIndex = 0;
+    }
+    const uint64_t lowest = lowestEquivalentValue(index);
+    const uint64_t width = uint64_t(1) << bucketIndex;
+    if (lowest > std::numeric_limits<uint64_t>::max() - width) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    return lowest + width;
+}
+
+/*
+ * LogLinearHistogram<> definitions of methods which we prefer to not inline.
+ */
+
+template <typename T, template <class> class Limits>
+cb::LogLinearHistogram<T, Limits>::LogLinearHistogram(T highestTrackableValue,
+                                                      int significantDigits)
+    : layout(toRaw(highestTrackableValue), significantDigits),
+      counts(new Couchbase::RelaxedAtomic<size_t>[layout.size()]) {
+}
+
+template <typename T, template <class> class Limits>
+void cb::LogLinearHistogram<T, Limits>::add(cb::sized_buffer<const T> values) {
+    // The indexes are computed for a block of values in a tight loop
+    // (without touching the counters) which the compiler may vectorize
+    const size_t blockSize = 256;
+    size_t indexes[blockSize];
+
+    // Counting in a local array covering all of the bins only pays off
+    // for large batches; for smaller batches we merge the runs of values
+    // hitting the same bin instead.
+    std::vector<size_t> local;
+    if (values.size() >= layout.size()) {
+        local.resize(layout.size());
+    }
+
+    for (size_t offset = 0; offset < values.size(); offset += blockSize) {
+        const size_t count = std::min(blockSize, values.size() - offset);
+        const T* block = values.data() + offset;
+        for (size_t ii = 0; ii < count; ++ii) {
+            indexes[ii] = layout.indexOf(toRaw(block[ii]));
+        }
+
+        if (!local.empty()) {
+            for (size_t ii = 0; ii < count; ++ii) {
+                ++local[indexes[ii]];
+            }
+            continue;
+        }
+
+        size_t run = 1;
+        for (size_t ii = 1; ii <= count; ++ii) {
+            if (ii < count && indexes[ii] == indexes[ii - 1]) {
+                ++run;
+            } else {
+                counts[indexes[ii - 1]].fetch_add(run);
+                run = 1;
+            }
+        }
+    }
+
+    for (size_t ii = 0; ii < local.size(); ++ii) {
+        if (local[ii] != 0) {
+            counts[ii].fetch_add(local[ii]);
+        }
+    }
+}
+
+template <typename T, template <class> class Limits>
+void cb::LogLinearHistogram<T, Limits>::reset() {
+    for (size_t ii = 0; ii < layout.size(); ++ii) {
+        counts[ii].reset();
+    }
+}
+
+template <typename T, template <class> class Limits>
+void cb::LogLinearHistogram<T, Limits>::merge(const LogLinearHistogram& other) {
+    if (layout != other.layout) {
+        throw std::invalid_argument(
+                "LogLinearHistogram::merge: can't merge histograms with "
+                "different layouts");
+    }
+    for (size_t ii = 0; ii < layout.size(); ++ii) {
+        const auto count = other.counts[ii].load();
+        if (count != 0) {
+            counts[ii].fetch_add(count);
+        }
+    }
+}
+
+template <typename T, template <class> class Limits>
+cb::LogLinearHistogram<T, Limits> cb::LogLinearHistogram<T, Limits>::snapshot()
+        const {
+    LogLinearHistogram ret(fromRaw(layout.getHighestTrackableValue()),
+                           layout.getSignificantDigits());
+    for (size_t ii = 0; ii < layout.size(); ++ii) {
+        ret.counts[ii].store(counts[ii].load());
+    }
+    return ret;
+}
+
+template <typename T, template <class> class Limits>
+cb::LogLinearHistogram<T, Limits> cb::LogLinearHistogram<T, Limits>::drain() {
+    LogLinearHistogram ret(fromRaw(layout.getHighestTrackableValue()),
+                           layout.getSignificantDigits());
+    for (size_t ii = 0; ii < layout.size(); ++ii) {
+        ret.counts[ii].store(counts[ii].exchange(0));
+    }
+    return ret;
+}
+
+template <typename T, template <class> class Limits>
+std::vector<uint8_t> cb::LogLinearHistogram<T, Limits>::encode() const {
+    using namespace cb::histogram_encoding;
+    std::vector<uint8_t> ret;
+    ret.push_back(uint8_t(Format::LogLinearHistogram));
+    encodeVarint(layout.getHighestTrackableValue(), ret);
+    encodeVarint(uint64_t(layout.getSignificantDigits()), ret);
+    encodeCounts(begin(), end(), ret);
+    return ret;
+}
+
+template <typename T, template <class> class Limits>
+cb::LogLinearHistogram<T, Limits> cb::LogLinearHistogram<T, Limits>::decode(
+        cb::const_byte_buffer encoded) {
+    using namespace cb::histogram_encoding;
+    if (encoded.empty() ||
+        encoded[0] != uint8_t(Format::LogLinearHistogram)) {
+        throw std::invalid_argument(
+                "LogLinearHistogram::decode: input is not an encoded "
+                "LogLinearHistogram");
+    }
+    encoded = {encoded.data() + 1, encoded.size() - 1};
+
+    const auto highest = decodeVarint(encoded);
+    const auto digits = decodeVarint(encoded);
+    if (highest > toRaw(Limits<T>::max()) || digits > 5) {
+        throw std::invalid_argument(
+                "LogLinearHistogram::decode: invalid layout");
+    }
+    // The constructor validates the rest of the layout
+    LogLinearHistogram ret(fromRaw(highest), int(digits));
+    decodeCounts(encoded, ret.size(), [&ret](size_t index, size_t count) {
+        ret.counts[index].store(count);
+    });
+    if (!encoded.empty()) {
+        throw std::invalid_argument(
+                "LogLinearHistogram::decode: unexpected data after the "
+                "histogram");
+    }
+    return ret;
+}
+
+template <typename T, template <class> class Limits>
+T cb::LogLinearHistogram<T, Limits>::percentile(double percentile) const {
+    return getHistogramPercentile<T, Limits>(begin(), end(), percentile);
+}
+
+template <typename T, template <class> class Limits>
+size_t cb::LogLinearHistogram<T, Limits>::total() const {
+    size_t ret = 0;
+    for (size_t ii = 0; ii < layout.size(); ++ii) {
+        ret += counts[ii].load();
+    }
+    return ret;
+}
+
+// Explicit template instantiations for all classes which we specialise
+// LogLinearHistogram<> for.
+template class PLATFORM_PUBLIC_API cb::LogLinearHistogram<uint16_t>;
+template class PLATFORM_PUBLIC_API cb::LogLinearHistogram<uint32_t>;
+template class PLATFORM_PUBLIC_API cb::LogLinearHistogram<size_t>;
+template class PLATFORM_PUBLIC_API
+        cb::LogLinearHistogram<UnsignedMicroseconds, cb::duration_limits>;
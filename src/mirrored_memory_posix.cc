@@ -0,0 +1,116 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <platform/mirrored_memory.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/**
+ * Create an anonymous file descriptor of the given size which may be
+ * mapped multiple times.
+ */
+static int createBackingFile(size_t size) {
+    int fd = -1;
+#if defined(__linux__) && defined(SYS_memfd_create)
+    // Use the syscall directly as the glibc wrapper is fairly new
+    fd = int(syscall(SYS_memfd_create, "cb::MirroredMemory", 0));
+#endif
+    if (fd == -1) {
+        // Fall back to an unlinked POSIX shared memory object
+        const std::string name = "/cb_mirrored_memory." +
+                                 std::to_string(getpid()) + "." +
+                                 std::to_string(uintptr_t(&fd));
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        if (fd == -1) {
+            throw std::system_error(
+                    errno,
+                    std::system_category(),
+                    "cb::MirroredMemory: shm_open() failed");
+        }
+        shm_unlink(name.c_str());
+    }
+
+    if (ftruncate(fd, off_t(size)) == -1) {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error,
+                                std::system_category(),
+                                "cb::MirroredMemory: ftruncate() failed");
+    }
+    return fd;
+}
+
+cb::MirroredMemory::MirroredMemory(size_t size) : root(nullptr), length(0) {
+    const auto pagesize = size_t(sysconf(_SC_PAGESIZE));
+    length = std::max(pagesize, ((size + pagesize - 1) / pagesize) * pagesize);
+
+    const int fd = createBackingFile(length);
+
+    // Reserve the address range for both mappings, then map the file
+    // on top of both halves
+    void* base = mmap(nullptr,
+                      length * 2,
+                      PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1,
+                      0);
+    if (base == MAP_FAILED) {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error,
+                                std::system_category(),
+                                "cb::MirroredMemory: mmap() failed to "
+                                "reserve address space");
+    }
+
+    auto* first = static_cast<uint8_t*>(base);
+    for (auto* addr : {first, first + length}) {
+        if (mmap(addr,
+                 length,
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED,
+                 fd,
+                 0) == MAP_FAILED) {
+            auto error = errno;
+            munmap(base, length * 2);
+            ::close(fd);
+            throw std::system_error(error,
+                                    std::system_category(),
+                                    "cb::MirroredMemory: mmap() failed");
+        }
+    }
+
+    // The mappings keep a reference to the file
+    ::close(fd);
+    root = first;
+}
+
+cb::MirroredMemory::~MirroredMemory() {
+    if (root != nullptr) {
+        munmap(root, length * 2);
+    }
+}
@@ -0,0 +1,92 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <platform/mirrored_memory.h>
+#include <platform/platform.h>
+
+#include <algorithm>
+#include <system_error>
+
+cb::MirroredMemory::MirroredMemory(size_t size)
+    : root(nullptr), length(0), maphandle(INVALID_HANDLE_VALUE) {
+    SYSTEM_INFO sysinfo;
+    GetSystemInfo(&sysinfo);
+    const size_t granularity = sysinfo.dwAllocationGranularity;
+    length = std::max(granularity,
+                      ((size + granularity - 1) / granularity) * granularity);
+
+    const uint64_t mapsize = length;
+    maphandle = CreateFileMapping(INVALID_HANDLE_VALUE,
+                                  nullptr,
+                                  PAGE_READWRITE,
+                                  DWORD(mapsize >> 32),
+                                  DWORD(mapsize & 0xffffffff),
+                                  nullptr);
+    if (maphandle == nullptr) {
+        maphandle = INVALID_HANDLE_VALUE;
+        throw std::system_error(GetLastError(),
+                                std::system_category(),
+                                "cb::MirroredMemory: CreateFileMapping() failed");
+    }
+
+    // There is no way to atomically reserve an address range and map
+    // views into it (without VirtualAlloc2), so find a free range and
+    // try to map the two views into it. Another thread may grab the
+    // range in between, so retry a few times.
+    DWORD error = 0;
+    for (int retry = 0; retry < 10 && root == nullptr; ++retry) {
+        void* base = VirtualAlloc(nullptr, length * 2, MEM_RESERVE, PAGE_NOACCESS);
+        if (base == nullptr) {
+            error = GetLastError();
+            break;
+        }
+        VirtualFree(base, 0, MEM_RELEASE);
+
+        auto* first = static_cast<uint8_t*>(base);
+        auto* view1 = MapViewOfFileEx(
+                maphandle, FILE_MAP_ALL_ACCESS, 0, 0, length, first);
+        if (view1 == nullptr) {
+            error = GetLastError();
+            continue;
+        }
+        auto* view2 = MapViewOfFileEx(
+                maphandle, FILE_MAP_ALL_ACCESS, 0, 0, length, first + length);
+        if (view2 == nullptr) {
+            error = GetLastError();
+            UnmapViewOfFile(view1);
+            continue;
+        }
+        root = first;
+    }
+
+    if (root == nullptr) {
+        CloseHandle(maphandle);
+        maphandle = INVALID_HANDLE_VALUE;
+        throw std::system_error(error,
+                                std::system_category(),
+                                "cb::MirroredMemory: MapViewOfFileEx() failed");
+    }
+}
+
+cb::MirroredMemory::~MirroredMemory() {
+    if (root != nullptr) {
+        UnmapViewOfFile(root);
+        UnmapViewOfFile(root + length);
+    }
+    if (maphandle != INVALID_HANDLE_VALUE) {
+        CloseHandle(maphandle);
+    }
+}
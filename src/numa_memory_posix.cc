@@ -0,0 +1,70 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <platform/numa_memory.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+cb::NumaMemory::NumaMemory(size_t size, size_t node)
+    : root(nullptr), length(0) {
+    const auto pagesize = size_t(sysconf(_SC_PAGESIZE));
+    length = std::max(pagesize, ((size + pagesize - 1) / pagesize) * pagesize);
+
+    void* base = mmap(nullptr,
+                      length,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1,
+                      0);
+    if (base == MAP_FAILED) {
+        throw std::system_error(
+                errno, std::system_category(), "cb::NumaMemory: mmap() failed");
+    }
+
+#if defined(__linux__) && defined(SYS_mbind)
+    // The pages aren't allocated until they are touched, so setting the
+    // policy of the range before returning it places all of the pages.
+    // Use the preferred policy (rather than bind) so that we fall back to
+    // the other nodes instead of failing if the node runs out of memory.
+    // Errors (no NUMA support in the kernel, node not allowed etc) are
+    // ignored; the pages are then allocated by the default policy.
+    const size_t bits = sizeof(unsigned long) * 8;
+    if (node < bits) {
+        const unsigned long mask = 1UL << node;
+        // The kernel reads maxnode - 1 bits from the mask
+        syscall(SYS_mbind, base, length, MPOL_PREFERRED, &mask, bits + 1, 0);
+    }
+#else
+    (void)node;
+#endif
+
+    root = static_cast<uint8_t*>(base);
+}
+
+cb::NumaMemory::~NumaMemory() {
+    if (root != nullptr) {
+        munmap(root, length);
+    }
+}
@@ -0,0 +1,53 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <platform/numa_memory.h>
+#include <platform/platform.h>
+
+#include <algorithm>
+#include <system_error>
+
+cb::NumaMemory::NumaMemory(size_t size, size_t node)
+    : root(nullptr), length(0) {
+    SYSTEM_INFO sysinfo;
+    GetSystemInfo(&sysinfo);
+    const size_t pagesize = sysinfo.dwPageSize;
+    length = std::max(pagesize, ((size + pagesize - 1) / pagesize) * pagesize);
+
+    void* base = VirtualAllocExNuma(GetCurrentProcess(),
+                                    nullptr,
+                                    length,
+                                    MEM_RESERVE | MEM_COMMIT,
+                                    PAGE_READWRITE,
+                                    DWORD(node));
+    if (base == nullptr) {
+        // The node may not exist; allocate from any node
+        base = VirtualAlloc(
+                nullptr, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+    if (base == nullptr) {
+        throw std::system_error(GetLastError(),
+                                std::system_category(),
+                                "cb::NumaMemory: VirtualAlloc() failed");
+    }
+    root = static_cast<uint8_t*>(base);
+}
+
+cb::NumaMemory::~NumaMemory() {
+    if (root != nullptr) {
+        VirtualFree(root, 0, MEM_RELEASE);
+    }
+}
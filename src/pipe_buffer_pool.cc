@@ -0,0 +1,206 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/cb_malloc.h>
+#include <platform/pipe_buffer_pool.h>
+
+#include <new>
+
+const size_t cb::PipeBufferPool::MinSize;
+const size_t cb::PipeBufferPool::MaxSize;
+const size_t cb::PipeBufferPool::NumSizeClasses;
+const size_t cb::PipeBufferPool::ThreadCacheSize;
+const size_t cb::PipeBufferPool::ThreadCacheMaxSize;
+
+namespace cb {
+
+/**
+ * The per-thread cache of buffers. When the thread terminates all of
+ * the cached buffers are moved to the global lists.
+ */
+struct PipeBufferPoolThreadCache {
+    struct Entry {
+        std::array<uint8_t*, PipeBufferPool::ThreadCacheSize> buffers;
+        size_t count = 0;
+    };
+
+    ~PipeBufferPoolThreadCache();
+
+    void flush() {
+        auto& pool = PipeBufferPool::instance();
+        for (size_t ii = 0; ii < entries.size(); ++ii) {
+            auto& entry = entries[ii];
+            while (entry.count > 0) {
+                auto* ptr = entry.buffers[--entry.count];
+                pool.sizeClasses[ii].cached--;
+                pool.releaseGlobal(ii, ptr);
+            }
+        }
+    }
+
+    std::array<Entry, PipeBufferPool::NumSizeClasses> entries;
+};
+
+static thread_local PipeBufferPoolThreadCache threadCache;
+
+// Set once the thread cache is destroyed. Buffers may be released after
+// that by the destructors of other thread local objects (owning a pipe)
+// during thread exit, and those must go directly to the global lists.
+static thread_local bool threadCacheDestroyed = false;
+
+PipeBufferPoolThreadCache::~PipeBufferPoolThreadCache() {
+    flush();
+    threadCacheDestroyed = true;
+}
+
+/// Get the cache of the calling thread (nullptr if it is destroyed)
+static PipeBufferPoolThreadCache* getThreadCache() {
+    if (threadCacheDestroyed) {
+        return nullptr;
+    }
+    return &threadCache;
+}
+
+} // namespace cb
+
+cb::PipeBufferPool& cb::PipeBufferPool::instance() {
+    // Intentionally leaked so that it outlives the thread caches of
+    // threads terminating during shutdown
+    static PipeBufferPool* pool = new PipeBufferPool;
+    return *pool;
+}
+
+size_t cb::PipeBufferPool::getSizeClass(size_t size) {
+    size_t sizeclass = 0;
+    size_t allocation = MinSize;
+    while (allocation < size) {
+        allocation <<= 1;
+        ++sizeclass;
+    }
+    return sizeclass;
+}
+
+size_t cb::PipeBufferPool::getAllocationSize(size_t size) {
+    if (size > MaxSize) {
+        return size;
+    }
+    return MinSize << getSizeClass(size);
+}
+
+uint8_t* cb::PipeBufferPool::allocate(size_t size) {
+    if (size > MaxSize) {
+        auto* ret = static_cast<uint8_t*>(cb_malloc(size));
+        if (ret == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ret;
+    }
+
+    const auto sizeclass = getSizeClass(size);
+    auto& sc = sizeClasses[sizeclass];
+    auto* cache = getThreadCache();
+    if (cache != nullptr && cache->entries[sizeclass].count > 0) {
+        auto& entry = cache->entries[sizeclass];
+        sc.cached--;
+        sc.inUse++;
+        return entry.buffers[--entry.count];
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(sc.mutex);
+        if (!sc.buffers.empty()) {
+            auto* ret = sc.buffers.back();
+            sc.buffers.pop_back();
+            sc.cached--;
+            sc.inUse++;
+            cachedBytes -= MinSize << sizeclass;
+            return ret;
+        }
+    }
+
+    auto* ret = static_cast<uint8_t*>(cb_malloc(MinSize << sizeclass));
+    if (ret == nullptr) {
+        throw std::bad_alloc();
+    }
+    sc.inUse++;
+    return ret;
+}
+
+void cb::PipeBufferPool::release(uint8_t* ptr, size_t size) {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    if (size > MaxSize) {
+        cb_free(ptr);
+        return;
+    }
+
+    const auto sizeclass = getSizeClass(size);
+    auto& sc = sizeClasses[sizeclass];
+    sc.inUse--;
+    auto* cache = getThreadCache();
+    if (cache != nullptr && (MinSize << sizeclass) <= ThreadCacheMaxSize) {
+        auto& entry = cache->entries[sizeclass];
+        if (entry.count < entry.buffers.size()) {
+            entry.buffers[entry.count++] = ptr;
+            sc.cached++;
+            return;
+        }
+    }
+
+    releaseGlobal(sizeclass, ptr);
+}
+
+void cb::PipeBufferPool::releaseGlobal(size_t sizeclass, uint8_t* ptr) {
+    const size_t size = MinSize << sizeclass;
+    if (cachedBytes.load() + size > cacheLimit.load()) {
+        cb_free(ptr);
+        return;
+    }
+
+    auto& sc = sizeClasses[sizeclass];
+    std::lock_guard<std::mutex> guard(sc.mutex);
+    sc.buffers.push_back(ptr);
+    sc.cached++;
+    cachedBytes += size;
+}
+
+void cb::PipeBufferPool::freeCached(size_t sizeclass, uint8_t* ptr) {
+    sizeClasses[sizeclass].cached--;
+    cb_free(ptr);
+}
+
+void cb::PipeBufferPool::purge() {
+    auto* cache = getThreadCache();
+    for (size_t ii = 0; ii < NumSizeClasses; ++ii) {
+        if (cache != nullptr) {
+            auto& entry = cache->entries[ii];
+            while (entry.count > 0) {
+                freeCached(ii, entry.buffers[--entry.count]);
+            }
+        }
+
+        auto& sc = sizeClasses[ii];
+        std::lock_guard<std::mutex> guard(sc.mutex);
+        for (auto* ptr : sc.buffers) {
+            freeCached(ii, ptr);
+            cachedBytes -= MinSize << ii;
+        }
+        sc.buffers.clear();
+    }
+}
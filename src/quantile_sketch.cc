@@ -0,0 +1,148 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/quantile_sketch.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+/*
+ * QuantileSketch<> definitions of methods which we prefer to not inline.
+ */
+
+template <typename T, template <class> class Limits>
+cb::QuantileSketch<T, Limits>::QuantileSketch(double relativeAccuracy,
+                                              T maxTrackableValue)
+    : relativeAccuracy(relativeAccuracy) {
+    if (!(relativeAccuracy > 0.0 && relativeAccuracy < 1.0)) {
+        throw std::invalid_argument(
+                "QuantileSketch: relativeAccuracy must be in the range "
+                "(0, 1)");
+    }
+    if (toRaw(maxTrackableValue) < 1) {
+        throw std::invalid_argument(
+                "QuantileSketch: maxTrackableValue must be >= 1");
+    }
+    gamma = (1.0 + relativeAccuracy) / (1.0 - relativeAccuracy);
+    multiplier = 1.0 / std::log(gamma);
+    numBuckets = size_t(std::ceil(std::log(double(toRaw(maxTrackableValue))) *
+                                  multiplier)) +
+                 1;
+    counts.reset(new Couchbase::RelaxedAtomic<size_t>[numBuckets]);
+}
+
+template <typename T, template <class> class Limits>
+uint64_t cb::QuantileSketch<T, Limits>::lowerBound(size_t index) const {
+    // Bucket i holds the values in (gamma^(i-1), gamma^i]
+    const double bound = std::pow(gamma, double(index) - 1.0);
+    if (bound >= double(std::numeric_limits<uint64_t>::max())) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    return uint64_t(bound) + 1;
+}
+
+template <typename T, template <class> class Limits>
+T cb::QuantileSketch<T, Limits>::estimate(size_t index) const {
+    // The value with the same relative distance to both ends of the bucket
+    const double value = 2.0 * std::pow(gamma, double(index)) / (gamma + 1.0);
+    const double max = double(toRaw(Limits<T>::max()));
+    if (value >= max) {
+        return Limits<T>::max();
+    }
+    // Only integer values are counted, so the rounded value must be one
+    // which could be counted in the bucket
+    const auto lowest = lowerBound(index);
+    const auto highest = std::max(lowest, lowerBound(index + 1) - 1);
+    const auto rounded = uint64_t(std::llround(value));
+    return T(std::min(highest, std::max(lowest, rounded)));
+}
+
+template <typename T, template <class> class Limits>
+T cb::QuantileSketch<T, Limits>::percentile(double percentile) const {
+    if (!(percentile >= 0.0 && percentile <= 100.0)) {
+        throw std::invalid_argument(
+                "QuantileSketch::percentile: percentile must be in the "
+                "range [0, 100]");
+    }
+
+    const auto count = total();
+    if (count == 0) {
+        return Limits<T>::min();
+    }
+
+    // The rank (0 based) of the requested sample
+    const double rank = percentile / 100.0 * double(count - 1);
+    size_t cumulative = zeroCount.load();
+    if (double(cumulative) > rank) {
+        return T(0);
+    }
+    for (size_t ii = 0; ii < numBuckets; ++ii) {
+        cumulative += counts[ii].load();
+        if (double(cumulative) > rank) {
+            return estimate(ii);
+        }
+    }
+    // Values were added while we iterated; return the largest bucket
+    for (size_t ii = numBuckets; ii > 0; --ii) {
+        if (counts[ii - 1].load() != 0) {
+            return estimate(ii - 1);
+        }
+    }
+    return T(0);
+}
+
+template <typename T, template <class> class Limits>
+void cb::QuantileSketch<T, Limits>::merge(const QuantileSketch& other) {
+    if (relativeAccuracy != other.relativeAccuracy ||
+        numBuckets != other.numBuckets) {
+        throw std::invalid_argument(
+                "QuantileSketch::merge: can't merge sketches with a "
+                "different configuration");
+    }
+    zeroCount.fetch_add(other.zeroCount.load());
+    for (size_t ii = 0; ii < numBuckets; ++ii) {
+        const auto count = other.counts[ii].load();
+        if (count != 0) {
+            counts[ii].fetch_add(count);
+        }
+    }
+}
+
+template <typename T, template <class> class Limits>
+void cb::QuantileSketch<T, Limits>::reset() {
+    zeroCount.reset();
+    for (size_t ii = 0; ii < numBuckets; ++ii) {
+        counts[ii].reset();
+    }
+}
+
+template <typename T, template <class> class Limits>
+size_t cb::QuantileSketch<T, Limits>::total() const {
+    size_t ret = zeroCount.load();
+    for (size_t ii = 0; ii < numBuckets; ++ii) {
+        ret += counts[ii].load();
+    }
+    return ret;
+}
+
+// Explicit template instantiations for all classes which we specialise
+// QuantileSketch<> for.
+template class PLATFORM_PUBLIC_API cb::QuantileSketch<uint16_t>;
+template class PLATFORM_PUBLIC_API cb::QuantileSketch<uint32_t>;
+template class PLATFORM_PUBLIC_API cb::QuantileSketch<size_t>;
+template class PLATFORM_PUBLIC_API
+        cb::QuantileSketch<UnsignedMicroseconds, cb::duration_limits>;
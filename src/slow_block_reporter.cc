@@ -0,0 +1,132 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/slow_block_reporter.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+cb::SlowBlockReporter& cb::SlowBlockReporter::instance() {
+    // Intentionally leaked (with the thread detached) so that it may be
+    // used by static destructors and threads still running during
+    // shutdown, and so that we never join the thread from a static
+    // destructor (which deadlocks under the loader lock on Windows).
+    // The pending reports are written at exit instead.
+    static SlowBlockReporter* reporter = []() {
+        auto* ret = new SlowBlockReporter(std::cerr, std::chrono::seconds(1));
+        ret->thread.detach();
+        std::atexit(writeAtExit);
+        return ret;
+    }();
+    return *reporter;
+}
+
+void cb::SlowBlockReporter::writeAtExit() {
+    // The background thread may have been terminated while holding the
+    // mutex (Windows terminates the other threads before running the
+    // exit handlers of a DLL), so don't wait for it
+    auto& reporter = instance();
+    std::unique_lock<std::mutex> lock(reporter.mutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+        reporter.write();
+    }
+}
+
+cb::SlowBlockReporter::SlowBlockReporter(std::ostream& out,
+                                         std::chrono::milliseconds interval,
+                                         size_t capacity)
+    : out(out), interval(interval), queue(capacity) {
+    thread = std::thread([this]() { run(); });
+}
+
+cb::SlowBlockReporter::~SlowBlockReporter() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stop = true;
+    }
+    cond.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+bool cb::SlowBlockReporter::report(const char* name,
+                                   std::chrono::milliseconds duration) {
+    Report report;
+    if (name == nullptr) {
+        name = "";
+    }
+    std::strncpy(report.name, name, MaxNameLength);
+    report.name[MaxNameLength] = '\0';
+    report.msec = uint64_t(duration.count());
+    if (!queue.try_push(report)) {
+        dropped++;
+        return false;
+    }
+    return true;
+}
+
+void cb::SlowBlockReporter::flush() {
+    std::lock_guard<std::mutex> guard(mutex);
+    write();
+}
+
+void cb::SlowBlockReporter::write() {
+    Report report;
+    while (queue.try_pop(report)) {
+        auto& aggregate = aggregates[report.name];
+        aggregate.count++;
+        aggregate.max = std::max(aggregate.max, report.msec);
+    }
+
+    const auto numDropped = dropped.load();
+    if (aggregates.empty() && numDropped == droppedReported) {
+        return;
+    }
+
+    for (const auto& entry : aggregates) {
+        out << "BlockTimer<" << entry.first << "> Took too long: ";
+        if (entry.second.count == 1) {
+            out << entry.second.max << "ms\n";
+        } else {
+            out << entry.second.count << " times, max " << entry.second.max
+                << "ms\n";
+        }
+    }
+    aggregates.clear();
+
+    if (numDropped != droppedReported) {
+        out << "BlockTimer: dropped " << (numDropped - droppedReported)
+            << " slow block reports\n";
+        droppedReported = numDropped;
+    }
+    out.flush();
+}
+
+void cb::SlowBlockReporter::run() {
+    cb_set_thread_name("slow_block");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stop) {
+        cond.wait_for(lock, interval, [this]() { return stop; });
+        write();
+    }
+    // Write the reports queued while we were stopping
+    write();
+}
@@ -33,6 +33,11 @@
 #include <string>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <dirent.h>
+#include <cstring>
+#endif
+
 size_t cb::get_available_cpu_count() {
     char *override = getenv("COUCHBASE_CPU_COUNT");
     if (override != nullptr) {
@@ -112,21 +117,63 @@ size_t cb::get_cpu_count() {
 }
 
 PLATFORM_PUBLIC_API
-size_t cb::get_cpu_index() {
+size_t cb::get_numa_node(size_t cpu) {
+#if defined(WIN32)
+    if (groupSize == 0) {
+        cb::get_cpu_count();
+    }
+    PROCESSOR_NUMBER processor = {};
+    if (groupSize != 0) {
+        processor.Group = WORD(cpu / groupSize);
+        processor.Number = BYTE(cpu % groupSize);
+    } else {
+        processor.Number = BYTE(cpu);
+    }
+    USHORT node;
+    if (GetNumaProcessorNodeEx(&processor, &node) && node != MAXUSHORT) {
+        return node;
+    }
+    return 0;
+#elif defined(__linux__)
+    // The directory of each CPU contains a link to the node it belongs to
+    // (/sys/devices/system/cpu/cpu<N>/node<M>)
+    const auto path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return 0;
+    }
+    size_t node = 0;
+    while (auto* entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "node", 4) == 0 &&
+            std::isdigit(entry->d_name[4])) {
+            node = std::stoul(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+#else
+    (void)cpu;
+    return 0;
+#endif
+}
+
+/**
+ * Get the current CPU of the caller
+ *
+ * @return the CPU or -1 (with errno set) if it can't be determined
+ */
+static int currentCpu() {
 #if defined(WIN32)
     if (groupSize == 0) {
         cb::get_cpu_count();
     }
     PROCESSOR_NUMBER processor;
     GetCurrentProcessorNumberEx(&processor);
-    return processor.Number + (processor.Group * groupSize);
+    return int(processor.Number + (processor.Group * groupSize));
 #elif defined(HAVE_SCHED_GETCPU)
-    int rv = sched_getcpu();
-    if (rv == -1) {
-        throw std::system_error(std::error_code(errno, std::system_category()),
-                                "cb::get_cpu_index(): sched_getcpu failed");
-    }
-    return rv;
+    // Uses the vDSO getcpu() where available
+    return sched_getcpu();
 #elif defined(__APPLE__)
     // From:
     // https://github.com/apple/darwin-xnu/blob/0a798f6738bc1db01281fc08ae024145e84df927/libsyscall/os/tsd.h
@@ -138,7 +185,7 @@ size_t cb::get_cpu_index() {
             uintptr_t ptr;
         } idt;
         __asm__("sidt %[p]" : [p] "=&m"(idt));
-        return size_t(idt.size & 0xfff);
+        return int(idt.size & 0xfff);
 #else
 #error get_cpu_index (macOS) not implemented on this architecture
 #endif
@@ -146,6 +193,28 @@ size_t cb::get_cpu_index() {
 #else // !HAVE_SCHED_GETCPU
     uint32_t registers[4] = {0, 0, 0, 0};
     __cpuid(1, registers[0], registers[1], registers[2], registers[3]);
-    return registers[1] >> 24;
+    return int(registers[1] >> 24);
 #endif
 }
+
+PLATFORM_PUBLIC_API
+size_t cb::get_cpu_index() {
+    // Prefer the rseq area registered by glibc (a plain load) over the
+    // vDSO call
+    int cpu = detail::get_rseq_cpu_id();
+    if (cpu >= 0) {
+        return size_t(cpu);
+    }
+    cpu = currentCpu();
+    if (cpu == -1) {
+        throw std::system_error(std::error_code(errno, std::system_category()),
+                                "cb::get_cpu_index(): sched_getcpu failed");
+    }
+    return size_t(cpu);
+}
+
+PLATFORM_PUBLIC_API
+size_t cb::detail::get_cpu_index_fallback() noexcept {
+    const int cpu = currentCpu();
+    return (cpu == -1) ? 0 : size_t(cpu);
+}
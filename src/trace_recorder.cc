@@ -0,0 +1,128 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/ring_buffer.h>
+#include <platform/trace_recorder.h>
+
+#include <algorithm>
+#include <chrono>
+
+cb::TraceRing::TraceRing(size_t capacity)
+    : mask(cb::roundUpToPowerOfTwo(std::max(capacity, size_t(1))) - 1),
+      slots(new Slot[mask + 1]) {
+}
+
+void cb::TraceRing::snapshot(uint32_t thread,
+                             std::vector<TraceEvent>& out) const {
+    const uint64_t end = head.load(std::memory_order_acquire);
+    const uint64_t begin = (end > capacity()) ? end - capacity() : 0;
+    for (uint64_t pos = begin; pos < end; ++pos) {
+        const Slot& slot = slots[pos & mask];
+        const auto sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * pos + 2) {
+            // The slot has been (or is being) overwritten
+            continue;
+        }
+        TraceEvent event;
+        event.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+        event.thread = thread;
+        event.id = slot.id.load(std::memory_order_relaxed);
+        event.payload[0] = slot.payload[0].load(std::memory_order_relaxed);
+        event.payload[1] = slot.payload[1].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+            out.push_back(event);
+        }
+    }
+}
+
+cb::TraceRecorder& cb::TraceRecorder::instance() {
+    static TraceRecorder recorder;
+    return recorder;
+}
+
+static std::atomic<uint64_t> nextRecorderUid{1};
+
+cb::TraceRecorder::TraceRecorder(size_t eventsPerThread)
+    : uid(nextRecorderUid++), eventsPerThread(eventsPerThread) {
+}
+
+namespace {
+// The ring used by the calling thread the last time it recorded an event
+struct ThreadRingCache {
+    uint64_t recorder = 0;
+    cb::TraceRing* ring = nullptr;
+};
+thread_local ThreadRingCache threadRingCache;
+} // namespace
+
+void cb::TraceRecorder::record(uint32_t id, uint64_t a, uint64_t b) {
+    if (!isEnabled()) {
+        return;
+    }
+    record(ProcessClock::now(), id, a, b);
+}
+
+void cb::TraceRecorder::record(ProcessClock::time_point timestamp,
+                               uint32_t id,
+                               uint64_t a,
+                               uint64_t b) {
+    if (!isEnabled()) {
+        return;
+    }
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            timestamp.time_since_epoch());
+    getRing().record(uint64_t(ns.count()), id, a, b);
+}
+
+cb::TraceRing& cb::TraceRecorder::getRing() {
+    auto& cache = threadRingCache;
+    if (cache.recorder == uid) {
+        return *cache.ring;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    auto& ring = threadRings[std::this_thread::get_id()];
+    if (ring == nullptr) {
+        rings.emplace_back(std::make_unique<TraceRing>(eventsPerThread));
+        ring = rings.back().get();
+    }
+    cache.recorder = uid;
+    cache.ring = ring;
+    return *ring;
+}
+
+std::vector<cb::TraceEvent> cb::TraceRecorder::snapshot() const {
+    std::vector<TraceEvent> ret;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        for (size_t ii = 0; ii < rings.size(); ++ii) {
+            rings[ii]->snapshot(uint32_t(ii), ret);
+        }
+    }
+    std::stable_sort(ret.begin(),
+                     ret.end(),
+                     [](const TraceEvent& a, const TraceEvent& b) {
+                         return a.timestamp < b.timestamp;
+                     });
+    return ret;
+}
+
+size_t cb::TraceRecorder::getNumThreads() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return rings.size();
+}
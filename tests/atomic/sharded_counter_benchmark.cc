@@ -0,0 +1,78 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <benchmark/benchmark.h>
+#include <platform/non_negative_counter.h>
+#include <platform/sharded_counter.h>
+#include <platform/sharded_non_negative_counter.h>
+#include <relaxed_atomic.h>
+
+// Incrementing a counter shared by all threads
+Couchbase::RelaxedAtomic<uint64_t> relaxedCounter;
+void RelaxedAtomicIncrement(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        relaxedCounter++;
+    }
+}
+BENCHMARK(RelaxedAtomicIncrement)->ThreadRange(1, 16);
+
+cb::ShardedCounter<uint64_t> shardedCounter;
+void ShardedCounterIncrement(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        shardedCounter++;
+    }
+}
+BENCHMARK(ShardedCounterIncrement)->ThreadRange(1, 16);
+
+// The cost of reading the counter
+void ShardedCounterLoad(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(shardedCounter.load());
+    }
+}
+BENCHMARK(ShardedCounterLoad);
+
+void ShardedCounterLoadApproximate(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(shardedCounter.loadApproximate());
+    }
+}
+BENCHMARK(ShardedCounterLoadApproximate);
+
+// Memory usage style accounting (incremented and decremented by all
+// threads)
+cb::NonNegativeCounter<size_t> nonNegativeCounter;
+void NonNegativeCounterAddSub(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        nonNegativeCounter += 64;
+        nonNegativeCounter -= 64;
+    }
+}
+BENCHMARK(NonNegativeCounterAddSub)->ThreadRange(1, 16);
+
+cb::ShardedNonNegativeCounter<size_t> shardedNonNegativeCounter;
+void ShardedNonNegativeCounterAddSub(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        shardedNonNegativeCounter += 64;
+        shardedNonNegativeCounter -= 64;
+    }
+}
+BENCHMARK(ShardedNonNegativeCounterAddSub)->ThreadRange(1, 16);
+
+BENCHMARK_MAIN()
@@ -0,0 +1,113 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/sharded_counter.h>
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+TEST(ShardedCounterTest, Operators) {
+    cb::ShardedCounter<uint64_t> counter;
+    EXPECT_EQ(0, counter.load());
+    EXPECT_EQ(cb::get_cpu_count(), counter.getNumShards());
+
+    counter++;
+    ++counter;
+    EXPECT_EQ(2, counter);
+    counter += 10;
+    EXPECT_EQ(12, counter);
+    counter -= 2;
+    counter--;
+    --counter;
+    EXPECT_EQ(8, counter);
+    counter.fetch_add(2);
+    counter.fetch_sub(1);
+    EXPECT_EQ(9, counter);
+
+    counter = 100;
+    EXPECT_EQ(100, counter);
+    counter.reset();
+    EXPECT_EQ(0, counter);
+
+    cb::ShardedCounter<uint64_t> other(5);
+    counter += other;
+    counter += other;
+    counter -= other;
+    EXPECT_EQ(5, counter);
+
+    cb::ShardedCounter<uint64_t> copy(counter);
+    EXPECT_EQ(5, copy);
+    copy = other;
+    EXPECT_EQ(5, copy);
+}
+
+TEST(ShardedCounterTest, Signed) {
+    cb::ShardedCounter<int64_t> counter;
+    counter -= 10;
+    EXPECT_EQ(-10, counter);
+    counter += 3;
+    EXPECT_EQ(-7, counter);
+}
+
+TEST(ShardedCounterTest, ManyThreads) {
+    const int numThreads = 4;
+    const int numIncrements = 100000;
+    cb::ShardedCounter<uint64_t> counter;
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < numThreads; ++ii) {
+        threads.emplace_back([&counter]() {
+            for (int jj = 0; jj < numIncrements; ++jj) {
+                counter++;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(numThreads * numIncrements, counter.load());
+}
+
+struct MockClockSource : cb::ProcessClockSource {
+    ProcessClock::time_point now() override {
+        return time;
+    }
+    ProcessClock::time_point time = ProcessClock::now();
+};
+
+TEST(ShardedCounterTest, LoadApproximate) {
+    MockClockSource clock;
+    cb::ShardedCounter<uint64_t> counter(seconds(1), clock);
+    counter += 10;
+    EXPECT_EQ(10, counter.loadApproximate());
+
+    // The cached value is returned until it is older than the max age
+    counter += 5;
+    EXPECT_EQ(10, counter.loadApproximate());
+    clock.time += seconds(1);
+    EXPECT_EQ(10, counter.loadApproximate());
+    clock.time += milliseconds(1);
+    EXPECT_EQ(15, counter.loadApproximate());
+    EXPECT_EQ(15, counter.load());
+
+    // Setting the value invalidates the cached value
+    counter = 1;
+    EXPECT_EQ(1, counter.loadApproximate());
+}
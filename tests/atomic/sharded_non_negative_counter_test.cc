@@ -0,0 +1,298 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <platform/sharded_non_negative_counter.h>
+
+#include <gtest/gtest.h>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+// The shard used by the calling thread (in the counters using TestShards)
+thread_local size_t testShard = 0;
+
+// A fixed number of shards where the test picks the shard used by each
+// thread (so that the tests use multiple shards independent of the number
+// of cores, and which core the threads run on)
+template <typename T>
+struct TestShards {
+    using Array = std::array<T, 4>;
+
+    T& get(std::nothrow_t) noexcept {
+        return shards[testShard % shards.size()];
+    }
+
+    size_t size() const {
+        return shards.size();
+    }
+
+    typename Array::iterator begin() {
+        return shards.begin();
+    }
+
+    typename Array::iterator end() {
+        return shards.end();
+    }
+
+    typename Array::const_iterator begin() const {
+        return shards.begin();
+    }
+
+    typename Array::const_iterator end() const {
+        return shards.end();
+    }
+
+    Array shards;
+};
+
+template <template <class> class UnderflowPolicy>
+using TestCounter = cb::ShardedNonNegativeCounter<
+        size_t,
+        UnderflowPolicy,
+        TestShards<Couchbase::RelaxedAtomic<ssize_t>>>;
+} // namespace
+
+TEST(ShardedNonNegativeCounterTest, InvalidBudget) {
+    EXPECT_THROW(cb::ShardedNonNegativeCounter<size_t>(0, 0),
+                 std::invalid_argument);
+    EXPECT_THROW(cb::ShardedNonNegativeCounter<size_t>(0, -1),
+                 std::invalid_argument);
+}
+
+TEST(ShardedNonNegativeCounterTest, Operators) {
+    cb::ShardedNonNegativeCounter<size_t> counter(1);
+    ASSERT_EQ(1, counter);
+
+    ++counter;
+    counter++;
+    EXPECT_EQ(3, counter);
+    counter += 2;
+    counter.fetch_add(2);
+    EXPECT_EQ(7, counter);
+    --counter;
+    counter--;
+    EXPECT_EQ(5, counter);
+    counter -= 2;
+    counter.fetch_sub(2);
+    EXPECT_EQ(1, counter);
+
+    counter = 10;
+    EXPECT_EQ(10, counter);
+
+    cb::ShardedNonNegativeCounter<size_t> copy(counter);
+    EXPECT_EQ(10, copy);
+    copy -= counter;
+    EXPECT_EQ(0, copy);
+}
+
+// Updates beyond the budget are moved to the total
+TEST(ShardedNonNegativeCounterTest, Budget) {
+    cb::ShardedNonNegativeCounter<size_t> counter(0, 4);
+    EXPECT_EQ(4, counter.getBudget());
+    for (int ii = 0; ii < 100; ++ii) {
+        counter += 3;
+        EXPECT_EQ((ii + 1) * 3, counter);
+    }
+    for (int ii = 0; ii < 100; ++ii) {
+        counter -= 3;
+        EXPECT_EQ(300 - (ii + 1) * 3, counter);
+    }
+}
+
+// Test that the counter will clamp to zero (when the budget is exhausted
+// and when read).
+TEST(ShardedNonNegativeCounterTest, ClampsToZero) {
+    cb::ShardedNonNegativeCounter<size_t, cb::ClampAtZeroUnderflowPolicy>
+            counter(0, 4);
+
+    // Within the budget; clamped when read
+    counter -= 2;
+    EXPECT_EQ(0, counter);
+    counter += 1;
+    EXPECT_EQ(1, counter);
+
+    // Exhausts the budget
+    counter = 5;
+    counter -= 10;
+    EXPECT_EQ(0, counter);
+    counter += 1;
+    EXPECT_EQ(1, counter);
+}
+
+// Test the ThrowException policy (the operation causing the underflow
+// isn't applied).
+TEST(ShardedNonNegativeCounterTest, ThrowExceptionPolicy) {
+    cb::ShardedNonNegativeCounter<size_t, cb::ThrowExceptionUnderflowPolicy>
+            counter(1, 4);
+
+    EXPECT_THROW(counter -= 10, std::underflow_error);
+    EXPECT_EQ(1, counter);
+
+    // Within the budget; detected when read
+    counter -= 2;
+    EXPECT_THROW(counter.load(), std::underflow_error);
+    counter += 2;
+    EXPECT_EQ(1, counter);
+}
+
+TEST(ShardedNonNegativeCounterTest, ManyThreads) {
+    const int numThreads = 4;
+    const int numUpdates = 100000;
+    cb::ShardedNonNegativeCounter<size_t, cb::ThrowExceptionUnderflowPolicy>
+            counter(0, 16);
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < numThreads; ++ii) {
+        threads.emplace_back([&counter]() {
+            for (int jj = 0; jj < numUpdates; ++jj) {
+                counter += 3;
+                counter -= 2;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(numThreads * numUpdates, counter.load());
+}
+
+// A decrement on one shard is matched by the increments on the other
+// shards before deciding that the counter underflowed
+TEST(ShardedNonNegativeCounterTest, MultipleShards) {
+    TestCounter<cb::ThrowExceptionUnderflowPolicy> counter(1, 8);
+    EXPECT_EQ(4, counter.getNumShards());
+
+    testShard = 0;
+    counter += 7;
+    testShard = 1;
+    counter -= 7;
+    EXPECT_EQ(1, counter.load());
+
+    // Exhausts the budget of shard 1 (the total is too small until the
+    // increments of shard 0 are folded in)
+    counter -= 1;
+    EXPECT_EQ(0, counter.load());
+
+    // A real underflow isn't applied
+    testShard = 0;
+    counter += 7;
+    testShard = 1;
+    EXPECT_THROW(counter -= 8, std::underflow_error);
+    EXPECT_EQ(7, counter.load());
+
+    // Within the budget; detected when read
+    testShard = 2;
+    counter -= 7;
+    EXPECT_EQ(0, counter.load());
+    testShard = 3;
+    counter -= 1;
+    EXPECT_THROW(counter.load(), std::underflow_error);
+    counter += 1;
+    EXPECT_EQ(0, counter.load());
+    testShard = 0;
+}
+
+// Each thread increments the counter on one shard before decrementing it
+// on another, so the counter never goes below zero. A small budget makes
+// the threads move deltas to the total all the time, while another thread
+// reads the counter; none of them may see an underflow, and no updates
+// may be lost.
+template <template <class> class UnderflowPolicy>
+static void testConcurrentMoves() {
+    const int numThreads = 4;
+    const int numUpdates = 100000;
+    TestCounter<UnderflowPolicy> counter(0, 2);
+    std::atomic<bool> done{false};
+    std::atomic<int> failures{0};
+
+    std::thread reader([&counter, &done, &failures]() {
+        while (!done) {
+            try {
+                counter.load();
+            } catch (const std::underflow_error&) {
+                failures++;
+            }
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < numThreads; ++ii) {
+        threads.emplace_back([&counter, &failures, ii]() {
+            for (int jj = 0; jj < numUpdates; ++jj) {
+                try {
+                    testShard = ii;
+                    counter += 3;
+                    testShard = ii + 1;
+                    counter -= 3;
+                } catch (const std::underflow_error&) {
+                    failures++;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    done = true;
+    reader.join();
+
+    EXPECT_EQ(0, failures);
+    EXPECT_EQ(0, counter.load());
+}
+
+TEST(ShardedNonNegativeCounterTest, ConcurrentMovesThrowException) {
+    testConcurrentMoves<cb::ThrowExceptionUnderflowPolicy>();
+}
+
+TEST(ShardedNonNegativeCounterTest, ConcurrentMovesClampAtZero) {
+    testConcurrentMoves<cb::ClampAtZeroUnderflowPolicy>();
+}
+
+// A real underflow is resolved by the underflow policy (within a bounded
+// number of passes over the shards) while other threads keep updating
+// their shards
+TEST(ShardedNonNegativeCounterTest, UnderflowWithConcurrentUpdates) {
+    const int numThreads = 3;
+    TestCounter<cb::ClampAtZeroUnderflowPolicy> counter(0, 8);
+    std::atomic<bool> done{false};
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < numThreads; ++ii) {
+        threads.emplace_back([&counter, &done, ii]() {
+            testShard = ii + 1;
+            while (!done) {
+                counter += 1;
+                counter -= 1;
+            }
+        });
+    }
+
+    testShard = 0;
+    for (int ii = 0; ii < 10000; ++ii) {
+        counter -= 100;
+        counter.load();
+    }
+    done = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(0, counter.load());
+}
@@ -0,0 +1,78 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include <benchmark/benchmark.h>
+#include <platform/corestore.h>
+#include <platform/sysinfo.h>
+
+#include <atomic>
+#include <cstdint>
+#ifdef HAVE_SCHED_GETCPU
+#include <sched.h>
+#endif
+
+// The different ways of finding the current CPU
+void GetCpuIndex(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(cb::get_cpu_index());
+    }
+}
+BENCHMARK(GetCpuIndex);
+
+void GetCpuIndexNoThrow(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(cb::get_cpu_index(std::nothrow));
+    }
+}
+BENCHMARK(GetCpuIndexNoThrow);
+
+#ifdef HAVE_SCHED_GETCPU
+void SchedGetcpu(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(sched_getcpu());
+    }
+}
+BENCHMARK(SchedGetcpu);
+#endif
+
+// Incrementing a counter in a CoreStore compared to a single shared atomic
+CoreStore<std::atomic<uint64_t>> coreStore;
+void CoreStoreGet(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        coreStore.get().fetch_add(1, std::memory_order_relaxed);
+    }
+}
+BENCHMARK(CoreStoreGet)->ThreadRange(1, 16);
+
+void CoreStoreGetNoThrow(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        coreStore.get(std::nothrow).fetch_add(1, std::memory_order_relaxed);
+    }
+}
+BENCHMARK(CoreStoreGetNoThrow)->ThreadRange(1, 16);
+
+std::atomic<uint64_t> sharedCounter;
+void SharedAtomic(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        sharedCounter.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+BENCHMARK(SharedAtomic)->ThreadRange(1, 16);
+
+BENCHMARK_MAIN()
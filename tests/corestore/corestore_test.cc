@@ -21,6 +21,7 @@
 
 #include <atomic>
 #include <iostream>
+#include <memory>
 
 class CoreStoreTest : public ::testing::Test {
 public:
@@ -48,4 +49,103 @@ TEST_F(CoreStoreTest, test) {
 
     // Expected on core slot to be non-zero
     EXPECT_EQ(1, count);
-}
\ No newline at end of file
+}
+
+TEST_F(CoreStoreTest, getNoThrow) {
+    CoreStore<std::atomic<uint32_t>> corestore;
+    corestore.get(std::nothrow)++;
+
+    uint32_t total = 0;
+    for (auto& e : corestore) {
+        total += e.load();
+    }
+    EXPECT_EQ(1, total);
+}
+
+TEST_F(CoreStoreTest, cpuIndex) {
+    EXPECT_LT(cb::get_cpu_index(), cb::get_cpu_count());
+    EXPECT_LT(cb::get_cpu_index(std::nothrow), cb::get_cpu_count());
+}
+
+// The elements are padded to the false sharing range by default
+TEST_F(CoreStoreTest, padded) {
+    using Padded = CoreStore<std::atomic<uint32_t>>;
+    EXPECT_EQ(alignof(cb::CachelinePadded<std::atomic<uint32_t>>),
+              alignof(Padded::slot_type));
+    Padded padded;
+    for (auto& e : padded) {
+        EXPECT_EQ(0, uintptr_t(&e) % alignof(Padded::slot_type));
+    }
+
+    CoreStore<std::atomic<uint32_t>, false> unpadded;
+    if (unpadded.size() > 1) {
+        auto it = unpadded.begin();
+        auto* first = &*it;
+        ++it;
+        EXPECT_EQ(first + 1, &*it);
+    }
+}
+
+// The elements don't need to be copyable or movable
+TEST_F(CoreStoreTest, constructWithArgs) {
+    CoreStore<std::atomic<uint32_t>> corestore(42);
+    for (const auto& e : corestore) {
+        EXPECT_EQ(42, e.load());
+    }
+}
+
+TEST_F(CoreStoreTest, numaLocal) {
+    using Store = CoreStore<std::atomic<uint32_t>>;
+    Store corestore(cb::numa_local, 1);
+    EXPECT_EQ(cb::get_cpu_count(), corestore.size());
+
+    corestore.get(std::nothrow)++;
+    uint32_t total = 0;
+    for (auto& e : corestore) {
+        EXPECT_EQ(0, uintptr_t(&e) % alignof(Store::slot_type));
+        total += e.load();
+    }
+    EXPECT_EQ(corestore.size() + 1, total);
+}
+
+// The iterators are random access for both layouts
+TEST_F(CoreStoreTest, randomAccessIterator) {
+    using Store = CoreStore<std::atomic<uint32_t>>;
+    Store contiguous(1);
+    Store numa(cb::numa_local, 1);
+    for (Store* corestore : {&contiguous, &numa}) {
+        const auto size = std::ptrdiff_t(corestore->size());
+        auto begin = corestore->begin();
+        auto end = corestore->end();
+        EXPECT_EQ(size, end - begin);
+        EXPECT_EQ(size, std::distance(begin, end));
+        EXPECT_TRUE(begin < end);
+        EXPECT_EQ(&*(end - 1), &begin[size - 1]);
+        EXPECT_EQ(begin + size, end);
+
+        begin[size - 1] = 10;
+        EXPECT_EQ(10, (--end)->load());
+
+        const Store& constStore = *corestore;
+        EXPECT_EQ(size, constStore.end() - constStore.begin());
+        EXPECT_EQ(10, constStore.begin()[size - 1].load());
+    }
+}
+
+TEST_F(CoreStoreTest, numaNode) {
+    for (size_t cpu = 0; cpu < cb::get_cpu_count(); ++cpu) {
+        // Every CPU is in a node (no way to tell which in a unit test..)
+        EXPECT_NO_THROW(cb::get_numa_node(cpu));
+    }
+    // A non-existing CPU is reported as node 0
+    EXPECT_EQ(0, cb::get_numa_node(cb::get_cpu_count() + 1000));
+}
+
+TEST_F(CoreStoreTest, destroysElements) {
+    auto counter = std::make_shared<int>(0);
+    {
+        CoreStore<std::shared_ptr<int>> corestore(counter);
+        EXPECT_EQ(corestore.size() + 1, counter.use_count());
+    }
+    EXPECT_EQ(1, counter.use_count());
+}
@@ -0,0 +1,105 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+// Include the histogram header first to ensure that it is standalone
+#include <platform/fixed_histogram.h>
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <vector>
+
+using SizeHistogram = cb::FixedHistogram<uint32_t, std::numeric_limits, 10, 100>;
+
+TEST(FixedHistogramTest, Bins) {
+    SizeHistogram histo;
+    EXPECT_EQ(3, histo.size());
+    EXPECT_EQ(0, histo.total());
+
+    histo.add(0);
+    histo.add(9, 2);
+    histo.add(10, 3);
+    histo.add(99);
+    histo.add(100, 5);
+    histo.add(std::numeric_limits<uint32_t>::max());
+    EXPECT_EQ(13, histo.total());
+
+    EXPECT_EQ(3, histo.getBin(5).count());
+    EXPECT_EQ(0, histo.getBin(5).start());
+    EXPECT_EQ(10, histo.getBin(5).end());
+    EXPECT_EQ(4, histo.getBin(50)->count());
+    EXPECT_EQ(6, histo.getBin(1000).count());
+    EXPECT_EQ(std::numeric_limits<uint32_t>::max(), histo.getBin(1000).end());
+
+    std::stringstream s;
+    s << histo;
+    EXPECT_EQ(
+            "{FixedHistogram: [0, 10) = 3, [10, 100) = 4, "
+            "[100, 4294967295) = 6}",
+            s.str());
+
+    histo.reset();
+    EXPECT_EQ(0, histo.total());
+}
+
+TEST(FixedHistogramTest, SameBinsAsMicrosecondHistogram) {
+    MicrosecondHistogram histo;
+    cb::MicrosecondFixedExponentialHistogram fixed;
+    EXPECT_EQ(std::distance(histo.begin(), histo.end()), fixed.size());
+
+    auto it = fixed.begin();
+    for (const auto& bin : histo) {
+        EXPECT_EQ(bin->start(), (*it)->start());
+        EXPECT_EQ(bin->end(), (*it)->end());
+        ++it;
+    }
+}
+
+TEST(FixedHistogramTest, AddBatch) {
+    SizeHistogram histo;
+    std::vector<uint32_t> values{1, 2, 3, 50, 500, 5000};
+    histo.add(values);
+    EXPECT_EQ(3, histo.getBin(0).count());
+    EXPECT_EQ(1, histo.getBin(10).count());
+    EXPECT_EQ(2, histo.getBin(100).count());
+}
+
+TEST(FixedHistogramTest, PercentileAndMerge) {
+    SizeHistogram histo;
+    SizeHistogram other;
+    histo.add(5, 10);
+    other.add(50, 10);
+    histo.merge(other);
+    EXPECT_EQ(20, histo.total());
+    EXPECT_EQ(10, histo.percentile(50));
+    EXPECT_EQ(55, histo.percentile(75));
+    EXPECT_THROW(histo.percentile(101), std::invalid_argument);
+}
+
+TEST(FixedHistogramTest, CountersAreInline) {
+    EXPECT_LE(3 * sizeof(size_t), sizeof(SizeHistogram));
+    EXPECT_LE(32 * sizeof(size_t),
+              sizeof(cb::MicrosecondFixedExponentialHistogram));
+}
+
+TEST(FixedHistogramTest, BlockTimer) {
+    cb::MicrosecondFixedExponentialHistogram histo;
+    {
+        GenericBlockTimer<cb::MicrosecondFixedExponentialHistogram, 0> timer(
+                &histo);
+    }
+    EXPECT_EQ(1, histo.total());
+}
@@ -0,0 +1,179 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <platform/fixed_histogram.h>
+#include <platform/histogram.h>
+#include <platform/loglinear_histogram.h>
+#include <platform/quantile_sketch.h>
+#include <platform/sharded_histogram.h>
+
+#include <random>
+#include <vector>
+
+// Generate a set of latency-like samples (mostly small values with a
+// long tail) so that the benchmarks hit different bins
+static std::vector<UnsignedMicroseconds> getSamples() {
+    std::mt19937_64 generator(0);
+    std::lognormal_distribution<double> distribution(5.0, 2.0);
+    std::vector<UnsignedMicroseconds> samples(4096);
+    for (auto& sample : samples) {
+        sample = UnsignedMicroseconds(uint64_t(distribution(generator)));
+    }
+    return samples;
+}
+
+// Benchmark adding values to the histogram doing a binary search over
+// the bins
+void HistogramAdd(benchmark::State& state) {
+    const auto samples = getSamples();
+    MicrosecondHistogram histogram;
+    size_t ii = 0;
+    while (state.KeepRunning()) {
+        histogram.add(samples[ii++ & (samples.size() - 1)]);
+    }
+}
+BENCHMARK(HistogramAdd);
+
+// Benchmark adding values to the histogram with compile time bins
+void FixedHistogramAdd(benchmark::State& state) {
+    const auto samples = getSamples();
+    cb::MicrosecondFixedExponentialHistogram histogram;
+    size_t ii = 0;
+    while (state.KeepRunning()) {
+        histogram.add(samples[ii++ & (samples.size() - 1)]);
+    }
+}
+BENCHMARK(FixedHistogramAdd);
+
+// Benchmark creating a histogram
+void HistogramCreate(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        MicrosecondHistogram histogram;
+        benchmark::DoNotOptimize(histogram);
+    }
+}
+BENCHMARK(HistogramCreate);
+
+// Benchmark creating a histogram with compile time bins
+void FixedHistogramCreate(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        cb::MicrosecondFixedExponentialHistogram histogram;
+        benchmark::DoNotOptimize(histogram);
+    }
+}
+BENCHMARK(FixedHistogramCreate);
+
+// Benchmark adding values to the log-linear histogram
+void LogLinearHistogramAdd(benchmark::State& state) {
+    const auto samples = getSamples();
+    cb::MicrosecondLogLinearHistogram histogram(std::chrono::hours(1), 2);
+    size_t ii = 0;
+    while (state.KeepRunning()) {
+        histogram.add(samples[ii++ & (samples.size() - 1)]);
+    }
+}
+BENCHMARK(LogLinearHistogramAdd);
+
+// Benchmark adding a batch of values to the histogram
+void HistogramAddBatch(benchmark::State& state) {
+    const auto samples = getSamples();
+    MicrosecondHistogram histogram;
+    while (state.KeepRunning()) {
+        histogram.add(samples);
+    }
+    state.SetItemsProcessed(state.iterations() * samples.size());
+}
+BENCHMARK(HistogramAddBatch);
+
+// Benchmark adding values one at a time to measure the same thing as the
+// batch benchmarks
+void HistogramAddOneByOne(benchmark::State& state) {
+    const auto samples = getSamples();
+    MicrosecondHistogram histogram;
+    while (state.KeepRunning()) {
+        for (const auto& sample : samples) {
+            histogram.add(sample);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * samples.size());
+}
+BENCHMARK(HistogramAddOneByOne);
+
+// Benchmark adding a batch of values to the log-linear histogram
+void LogLinearHistogramAddBatch(benchmark::State& state) {
+    const auto samples = getSamples();
+    cb::MicrosecondLogLinearHistogram histogram(std::chrono::hours(1), 2);
+    while (state.KeepRunning()) {
+        histogram.add(samples);
+    }
+    state.SetItemsProcessed(state.iterations() * samples.size());
+}
+BENCHMARK(LogLinearHistogramAddBatch);
+
+// Benchmark adding values to the quantile sketch
+void QuantileSketchAdd(benchmark::State& state) {
+    const auto samples = getSamples();
+    cb::MicrosecondQuantileSketch sketch;
+    size_t ii = 0;
+    while (state.KeepRunning()) {
+        sketch.add(samples[ii++ & (samples.size() - 1)]);
+    }
+}
+BENCHMARK(QuantileSketchAdd);
+
+// Benchmark timing an empty block
+void BlockTimerEmptyBlock(benchmark::State& state) {
+    MicrosecondHistogram histogram;
+    while (state.KeepRunning()) {
+        BlockTimer timer(&histogram);
+    }
+}
+BENCHMARK(BlockTimerEmptyBlock);
+
+// Benchmark timing an empty block when only sampling 1 in 64 executions
+void SampledBlockTimerEmptyBlock(benchmark::State& state) {
+    MicrosecondHistogram histogram;
+    while (state.KeepRunning()) {
+        SampledBlockTimer<64> timer(&histogram);
+    }
+}
+BENCHMARK(SampledBlockTimerEmptyBlock);
+
+// Benchmark many threads recording values in the same histogram
+cb::MicrosecondLogLinearHistogram sharedHistogram(std::chrono::hours(1), 2);
+void LogLinearHistogramContended(benchmark::State& state) {
+    const auto samples = getSamples();
+    size_t ii = 0;
+    while (state.KeepRunning()) {
+        sharedHistogram.add(samples[ii++ & (samples.size() - 1)]);
+    }
+}
+BENCHMARK(LogLinearHistogramContended)->ThreadRange(1, 16);
+
+// Benchmark many threads recording values in the same sharded histogram
+cb::MicrosecondShardedHistogram shardedHistogram(std::chrono::hours(1), 2);
+void ShardedHistogramContended(benchmark::State& state) {
+    const auto samples = getSamples();
+    size_t ii = 0;
+    while (state.KeepRunning()) {
+        shardedHistogram.add(samples[ii++ & (samples.size() - 1)]);
+    }
+}
+BENCHMARK(ShardedHistogramContended)->ThreadRange(1, 16);
+
+BENCHMARK_MAIN()
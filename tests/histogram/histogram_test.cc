@@ -23,6 +23,7 @@
 
 #include <cmath>
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <sstream>
 #include <thread>
@@ -114,6 +115,226 @@ TEST(HistoTest, CompleteRange) {
     } while (i != 0);
 }
 
+TEST(HistoTest, AddBatch) {
+    Histogram<int> histo;
+    Histogram<int> expected;
+    std::vector<int> values;
+    for (int ii = 0; ii < 1000; ++ii) {
+        values.push_back((ii * 7919) % 5000);
+        expected.add(values.back());
+    }
+    values.push_back(std::numeric_limits<int>::max());
+    expected.add(std::numeric_limits<int>::max());
+
+    histo.add(values);
+    auto it = expected.begin();
+    for (const auto& bin : histo) {
+        EXPECT_EQ((*it)->count(), bin->count()) << *bin;
+        ++it;
+    }
+    EXPECT_EQ(1001, histo.total());
+
+    // Empty batch
+    histo.add(cb::sized_buffer<const int>{});
+    EXPECT_EQ(1001, histo.total());
+}
+
+TEST(HistoTest, Percentile) {
+    std::vector<int> input{0, 10, 20, 30};
+    FixedInputGenerator<int> gen(input);
+    Histogram<int> histo(gen, 3);
+
+    // Empty histogram
+    EXPECT_EQ(std::numeric_limits<int>::min(), histo.percentile(50));
+
+    // 10 samples in [0, 10) and 10 in [10, 20)
+    histo.add(5, 10);
+    histo.add(15, 10);
+    // The 0th percentile is the rank of the first sample
+    EXPECT_EQ(1, histo.percentile(0));
+    EXPECT_EQ(5, histo.percentile(25));
+    EXPECT_EQ(10, histo.percentile(50));
+    EXPECT_EQ(15, histo.percentile(75));
+    EXPECT_EQ(20, histo.percentile(100));
+
+    // The open ended last bin returns its start
+    histo.add(100);
+    EXPECT_EQ(30, histo.percentile(100));
+
+    EXPECT_THROW(histo.percentile(-1), std::invalid_argument);
+    EXPECT_THROW(histo.percentile(100.1), std::invalid_argument);
+}
+
+TEST(HistoTest, MicrosecondPercentile) {
+    MicrosecondHistogram histo;
+    for (int ii = 0; ii < 99; ++ii) {
+        histo.add(std::chrono::microseconds(10));
+    }
+    histo.add(std::chrono::microseconds(5000));
+    // 10us is counted in [8, 16)
+    EXPECT_LE(UnsignedMicroseconds(8), histo.percentile(50));
+    EXPECT_GT(UnsignedMicroseconds(16), histo.percentile(50));
+    EXPECT_LE(UnsignedMicroseconds(4096), histo.percentile(99.9));
+}
+
+TEST(HistoTest, Merge) {
+    std::vector<int> input{0, 10, 20, 30};
+    FixedInputGenerator<int> gen(input);
+    Histogram<int> histo(gen, 3);
+    FixedInputGenerator<int> gen2(input);
+    Histogram<int> other(gen2, 3);
+
+    histo.add(5, 2);
+    other.add(5, 3);
+    other.add(25, 1);
+    histo.merge(other);
+    EXPECT_EQ(5, histo.getBin(5)->count());
+    EXPECT_EQ(1, histo.getBin(25)->count());
+    EXPECT_EQ(6, histo.total());
+
+    // Merging histograms with different bins fails
+    std::vector<int> input2{0, 10, 20, 40};
+    FixedInputGenerator<int> gen3(input2);
+    Histogram<int> different(gen3, 3);
+    EXPECT_THROW(histo.merge(different), std::invalid_argument);
+    Histogram<int> defaultHisto;
+    EXPECT_THROW(histo.merge(defaultHisto), std::invalid_argument);
+}
+TEST(HistoTest, Snapshot) {
+    Histogram<int> histo;
+    histo.add(5, 2);
+    histo.add(100, 3);
+    auto snapshot = histo.snapshot();
+    histo.add(5);
+    EXPECT_EQ(5, snapshot.total());
+    EXPECT_EQ(2, snapshot.getBin(5)->count());
+    EXPECT_EQ(3, histo.getBin(5)->count());
+    EXPECT_EQ(6, histo.total());
+
+    // The snapshot has the same bins
+    EXPECT_NO_THROW(histo.merge(snapshot));
+    EXPECT_EQ(11, histo.total());
+}
+
+TEST(HistoTest, Drain) {
+    MicrosecondHistogram histo;
+    histo.add(std::chrono::microseconds(10), 4);
+    auto delta = histo.drain();
+    EXPECT_EQ(4, delta.total());
+    EXPECT_EQ(0, histo.total());
+
+    histo.add(std::chrono::microseconds(10));
+    delta = histo.drain();
+    EXPECT_EQ(1, delta.total());
+    EXPECT_EQ(1, delta.getBin(std::chrono::microseconds(10))->count());
+}
+
+TEST(HistoTest, DrainWhileAdding) {
+    // No value should be lost or counted twice when draining while
+    // other threads are adding values
+    Histogram<uint32_t> histo;
+    std::atomic<bool> running{true};
+    const int numThreads = 2;
+    const uint32_t numValues = 10000;
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < numThreads; ++ii) {
+        threads.emplace_back([&histo]() {
+            for (uint32_t value = 0; value < numValues; ++value) {
+                histo.add(value);
+                if ((value % 100) == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    size_t drained = 0;
+    std::thread collector([&histo, &running, &drained]() {
+        while (running) {
+            drained += histo.drain().total();
+            std::this_thread::yield();
+        }
+    });
+
+    for (auto& t : threads) {
+        t.join();
+    }
+    running = false;
+    collector.join();
+    drained += histo.drain().total();
+    EXPECT_EQ(numThreads * numValues, drained);
+}
+TEST(HistoTest, EncodeDecode) {
+    MicrosecondHistogram histo;
+    histo.add(std::chrono::microseconds(10), 1000);
+    histo.add(std::chrono::microseconds(20), 990);
+    histo.add(std::chrono::seconds(10), 1);
+
+    const auto encoded = histo.encode();
+    // Most of the space is used by the 30 bin boundaries (the largest
+    // deltas need 5 bytes each), and each of the 3 non-zero bins needs
+    // a few bytes
+    EXPECT_GT(100, encoded.size());
+
+    auto decoded = MicrosecondHistogram::decode(
+            {encoded.data(), encoded.size()});
+    EXPECT_EQ(histo.total(), decoded.total());
+    auto it = decoded.begin();
+    for (const auto& bin : histo) {
+        ASSERT_NE(decoded.end(), it);
+        EXPECT_EQ(bin->start(), (*it)->start());
+        EXPECT_EQ(bin->end(), (*it)->end());
+        EXPECT_EQ(bin->count(), (*it)->count());
+        ++it;
+    }
+    EXPECT_EQ(decoded.end(), it);
+
+    // The decoded histogram may be merged with the original
+    decoded.merge(histo);
+    EXPECT_EQ(2 * histo.total(), decoded.total());
+}
+
+TEST(HistoTest, EncodeDecodeSigned) {
+    std::vector<int> input{-100, -10, 0, 10, 1000};
+    FixedInputGenerator<int> gen(input);
+    Histogram<int> histo(gen, 4);
+    histo.add(-50, 3);
+    histo.add(std::numeric_limits<int>::min(), 2);
+    histo.add(5000, 7);
+
+    const auto encoded = histo.encode();
+    auto decoded = Histogram<int>::decode({encoded.data(), encoded.size()});
+    EXPECT_EQ(3, decoded.getBin(-50)->count());
+    EXPECT_EQ(-100, decoded.getBin(-50)->start());
+    EXPECT_EQ(2, decoded.getBin(-1000)->count());
+    EXPECT_EQ(7, decoded.getBin(5000)->count());
+    EXPECT_EQ(12, decoded.total());
+    EXPECT_NO_THROW(histo.merge(decoded));
+}
+
+TEST(HistoTest, DecodeInvalid) {
+    Histogram<uint32_t> histo;
+    histo.add(10, 5);
+    auto encoded = histo.encode();
+
+    // Truncated input
+    for (size_t ii = 0; ii < encoded.size(); ++ii) {
+        EXPECT_THROW(Histogram<uint32_t>::decode({encoded.data(), ii}),
+                     std::invalid_argument)
+                << "length " << ii;
+    }
+
+    // Trailing data
+    auto extra = encoded;
+    extra.push_back(0);
+    EXPECT_THROW(Histogram<uint32_t>::decode({extra.data(), extra.size()}),
+                 std::invalid_argument);
+
+    // Unknown format
+    encoded[0] = 0xff;
+    EXPECT_THROW(Histogram<uint32_t>::decode({encoded.data(), encoded.size()}),
+                 std::invalid_argument);
+}
 
 TEST(BlockTimerTest, Basic) {
     MicrosecondHistogram histo;
@@ -136,6 +357,59 @@ TEST(BlockTimerTest, ThresholdTest) {
     EXPECT_EQ(1, histo.total());
 }
 
+TEST(BlockTimerTest, Sampled) {
+    MicrosecondHistogram histo;
+    for (int ii = 0; ii < 100; ++ii) {
+        SampledBlockTimer<10> timer(&histo);
+    }
+    // 10 of the executions are timed, and each is recorded with a count
+    // of 10
+    EXPECT_EQ(100, histo.total());
+
+    // Disabled timers don't touch the countdown
+    for (int ii = 0; ii < 5; ++ii) {
+        SampledBlockTimer<10> timer(nullptr);
+    }
+    for (int ii = 0; ii < 10; ++ii) {
+        SampledBlockTimer<10> timer(&histo);
+    }
+    EXPECT_EQ(110, histo.total());
+}
+
+TEST(BlockTimerTest, SampledPerThread) {
+    // Each thread has its own countdown; so the first execution on each
+    // thread is timed
+    MicrosecondHistogram histo;
+    std::thread thread([&histo]() {
+        GenericSampledBlockTimer<MicrosecondHistogram, 1000> timer(&histo);
+    });
+    thread.join();
+    {
+        GenericSampledBlockTimer<MicrosecondHistogram, 1000> timer(&histo);
+    }
+    EXPECT_EQ(2000, histo.total());
+}
+
+TEST(BlockTimerTest, SampledPerHistogram) {
+    // Two blocks of the same timer type recording into different
+    // histograms are interleaved; both should be sampled (with a shared
+    // countdown only the first one would ever be timed)
+    MicrosecondHistogram first;
+    MicrosecondHistogram second;
+    for (int ii = 0; ii < 1000; ++ii) {
+        {
+            GenericSampledBlockTimer<MicrosecondHistogram, 2> timer(&first);
+        }
+        {
+            GenericSampledBlockTimer<MicrosecondHistogram, 2> timer(&second);
+        }
+    }
+    // (exactly 1000 unless the histograms share a countdown entry, in
+    // which case the executions are sampled at random)
+    EXPECT_NEAR(1000, first.total(), 200);
+    EXPECT_NEAR(1000, second.total(), 200);
+}
+
 TEST(MoveTest, Basic){
     Histogram<int> histo;
     std::stringstream s;
@@ -0,0 +1,223 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+// Include the histogram header first to ensure that it is standalone
+#include <platform/loglinear_histogram.h>
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <vector>
+
+TEST(LogLinearLayoutTest, InvalidConfig) {
+    EXPECT_THROW(cb::LogLinearLayout(1000, 0), std::invalid_argument);
+    EXPECT_THROW(cb::LogLinearLayout(1000, 6), std::invalid_argument);
+    EXPECT_THROW(cb::LogLinearLayout(1, 2), std::invalid_argument);
+}
+
+TEST(LogLinearLayoutTest, BinsAreContiguous) {
+    cb::LogLinearLayout layout(std::numeric_limits<uint64_t>::max(), 2);
+    uint64_t prev = 0;
+    for (size_t ii = 0; ii < layout.size(); ++ii) {
+        EXPECT_EQ(prev, layout.lowestEquivalentValue(ii)) << "index " << ii;
+        prev = layout.nextNonEquivalentValue(ii);
+    }
+    EXPECT_EQ(std::numeric_limits<uint64_t>::max(), prev);
+}
+
+TEST(LogLinearLayoutTest, IndexOf) {
+    cb::LogLinearLayout layout(std::numeric_limits<uint64_t>::max(), 2);
+    // Every value should end up in the bin covering it
+    for (uint64_t value : {uint64_t(0),
+                           uint64_t(1),
+                           uint64_t(255),
+                           uint64_t(256),
+                           uint64_t(257),
+                           uint64_t(1000),
+                           uint64_t(123456789),
+                           uint64_t(1) << 63,
+                           std::numeric_limits<uint64_t>::max()}) {
+        const auto index = layout.indexOf(value);
+        ASSERT_LT(index, layout.size());
+        EXPECT_LE(layout.lowestEquivalentValue(index), value);
+        if (value != std::numeric_limits<uint64_t>::max()) {
+            EXPECT_GT(layout.nextNonEquivalentValue(index), value);
+        }
+    }
+}
+
+TEST(LogLinearLayoutTest, Precision) {
+    // With 2 significant digits the width of a bin should never exceed 1%
+    // of the values it covers
+    cb::LogLinearLayout layout(uint64_t(1) << 40, 2);
+    for (size_t ii = 0; ii < layout.size(); ++ii) {
+        const auto lowest = layout.lowestEquivalentValue(ii);
+        const auto width = layout.nextNonEquivalentValue(ii) - lowest;
+        if (width > 1) {
+            EXPECT_LE(width * 100, lowest) << "index " << ii;
+        }
+    }
+}
+
+TEST(LogLinearHistogramTest, AddAndIterate) {
+    cb::LogLinearHistogram<uint32_t> histo(1000000, 2);
+    histo.add(0);
+    histo.add(5, 2);
+    histo.add(100000, 3);
+    // Values above the highest trackable value go in the last bin
+    histo.add(std::numeric_limits<uint32_t>::max(), 4);
+    EXPECT_EQ(10, histo.total());
+
+    EXPECT_EQ(2, histo.getBin(5).count());
+    EXPECT_EQ(3, histo.getBin(100000)->count());
+    EXPECT_LE(histo.getBin(100000).start(), 100000u);
+    EXPECT_GT(histo.getBin(100000).end(), 100000u);
+
+    // Iterate like we do for Histogram<T>
+    size_t total = 0;
+    uint32_t prev = 0;
+    for (const auto& bin : histo) {
+        EXPECT_EQ(prev, bin->start());
+        prev = bin->end();
+        total += bin->count();
+    }
+    EXPECT_EQ(std::numeric_limits<uint32_t>::max(), prev);
+    EXPECT_EQ(10, total);
+
+    std::stringstream s;
+    s << histo;
+    EXPECT_EQ(
+            "{LogLinearHistogram: [0, 1) = 1, [5, 6) = 2, "
+            "[99840, 100352) = 3, [1044480, 4294967295) = 4}",
+            s.str());
+
+    histo.reset();
+    EXPECT_EQ(0, histo.total());
+}
+
+TEST(LogLinearHistogramTest, AddBatch) {
+    // Both small batches (merging runs) and large batches (counting in a
+    // local array) should give the same result as adding one at a time
+    for (size_t size : {size_t(0), size_t(10), size_t(1000), size_t(100000)}) {
+        cb::LogLinearHistogram<uint32_t> histo(1000000, 2);
+        cb::LogLinearHistogram<uint32_t> expected(1000000, 2);
+        std::vector<uint32_t> values;
+        for (size_t ii = 0; ii < size; ++ii) {
+            // Runs of the same value, and values out of range
+            values.push_back(uint32_t((ii / 3) * 7919));
+            expected.add(values.back());
+        }
+        histo.add(values);
+        EXPECT_EQ(size, histo.total());
+        auto it = expected.begin();
+        for (const auto& bin : histo) {
+            ASSERT_EQ((*it).count(), bin.count()) << "size " << size;
+            ++it;
+        }
+    }
+}
+
+TEST(LogLinearHistogramTest, Microseconds) {
+    cb::MicrosecondLogLinearHistogram histo(std::chrono::seconds(60), 3);
+    histo.add(std::chrono::milliseconds(1));
+    histo.add(std::chrono::microseconds(1500));
+    EXPECT_EQ(1, histo.getBin(std::chrono::microseconds(1000)).count());
+    EXPECT_EQ(UnsignedMicroseconds(1000),
+              histo.getBin(std::chrono::microseconds(1000)).start());
+    EXPECT_EQ(2, histo.total());
+}
+
+TEST(LogLinearHistogramTest, Move) {
+    cb::LogLinearHistogram<size_t> histo(1000, 1);
+    histo.add(10, 5);
+    cb::LogLinearHistogram<size_t> other(std::move(histo));
+    EXPECT_EQ(5, other.total());
+}
+
+TEST(LogLinearHistogramTest, BlockTimer) {
+    cb::MicrosecondLogLinearHistogram histo;
+    {
+        GenericBlockTimer<cb::MicrosecondLogLinearHistogram, 0> timer(&histo);
+    }
+    EXPECT_EQ(1, histo.total());
+}
+
+TEST(LogLinearHistogramTest, SampledBlockTimer) {
+    cb::MicrosecondLogLinearHistogram histo;
+    for (int ii = 0; ii < 64; ++ii) {
+        GenericSampledBlockTimer<cb::MicrosecondLogLinearHistogram, 32> timer(
+                &histo);
+    }
+    EXPECT_EQ(64, histo.total());
+}
+
+TEST(LogLinearHistogramTest, Percentile) {
+    cb::LogLinearHistogram<uint32_t> histo(1000000, 2);
+    EXPECT_EQ(0, histo.percentile(99));
+    for (uint32_t value = 1; value <= 10000; ++value) {
+        histo.add(value);
+    }
+    // 2 significant digits; the result should be within 1%
+    EXPECT_NEAR(5000, histo.percentile(50), 50);
+    EXPECT_NEAR(9900, histo.percentile(99), 99);
+    EXPECT_NEAR(9990, histo.percentile(99.9), 100);
+    EXPECT_THROW(histo.percentile(101), std::invalid_argument);
+}
+
+TEST(LogLinearHistogramTest, SnapshotAndDrain) {
+    cb::LogLinearHistogram<uint32_t> histo(1000000, 2);
+    histo.add(10, 2);
+    histo.add(1000, 3);
+
+    auto snapshot = histo.snapshot();
+    histo.add(10);
+    EXPECT_EQ(5, snapshot.total());
+    EXPECT_EQ(histo.getLayout(), snapshot.getLayout());
+
+    auto delta = histo.drain();
+    EXPECT_EQ(6, delta.total());
+    EXPECT_EQ(3, delta.getBin(10).count());
+    EXPECT_EQ(0, histo.total());
+}
+
+TEST(LogLinearHistogramTest, EncodeDecode) {
+    cb::MicrosecondLogLinearHistogram histo(std::chrono::seconds(60), 2);
+    histo.add(std::chrono::microseconds(100), 1000);
+    histo.add(std::chrono::microseconds(101), 1001);
+    histo.add(std::chrono::seconds(1), 2);
+
+    const auto encoded = histo.encode();
+    EXPECT_GT(20, encoded.size());
+    auto decoded = cb::MicrosecondLogLinearHistogram::decode(
+            {encoded.data(), encoded.size()});
+    EXPECT_EQ(histo.getLayout(), decoded.getLayout());
+    EXPECT_EQ(histo.total(), decoded.total());
+    for (const auto& bin : histo) {
+        EXPECT_EQ(bin.count(), decoded.getBin(bin.start()).count());
+    }
+    decoded.merge(histo);
+    EXPECT_EQ(2 * histo.total(), decoded.total());
+
+    // A Histogram can't be decoded as a LogLinearHistogram
+    MicrosecondHistogram other;
+    const auto otherEncoded = other.encode();
+    EXPECT_THROW(cb::MicrosecondLogLinearHistogram::decode(
+                         {otherEncoded.data(), otherEncoded.size()}),
+                 std::invalid_argument);
+    EXPECT_THROW(cb::MicrosecondLogLinearHistogram::decode(
+                         {encoded.data(), encoded.size() - 1}),
+                 std::invalid_argument);
+}
@@ -0,0 +1,127 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+// Include the sketch header first to ensure that it is standalone
+#include <platform/quantile_sketch.h>
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <vector>
+
+TEST(QuantileSketchTest, InvalidConfig) {
+    EXPECT_THROW(cb::QuantileSketch<uint32_t>(0.0), std::invalid_argument);
+    EXPECT_THROW(cb::QuantileSketch<uint32_t>(1.0), std::invalid_argument);
+    EXPECT_THROW(cb::QuantileSketch<uint32_t>(0.01, 0),
+                 std::invalid_argument);
+}
+
+TEST(QuantileSketchTest, Empty) {
+    cb::QuantileSketch<uint32_t> sketch;
+    EXPECT_EQ(0, sketch.total());
+    EXPECT_EQ(0, sketch.percentile(50));
+    EXPECT_THROW(sketch.percentile(-1), std::invalid_argument);
+    EXPECT_THROW(sketch.percentile(101), std::invalid_argument);
+}
+
+TEST(QuantileSketchTest, RelativeError) {
+    const double accuracy = 0.01;
+    cb::QuantileSketch<size_t> sketch(accuracy);
+    std::mt19937_64 generator(0);
+    std::lognormal_distribution<double> distribution(8.0, 3.0);
+    std::vector<uint64_t> values(10000);
+    for (auto& value : values) {
+        value = uint64_t(distribution(generator));
+        sketch.add(value);
+    }
+    std::sort(values.begin(), values.end());
+    EXPECT_EQ(values.size(), sketch.total());
+
+    for (double percentile : {0.0, 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 100.0}) {
+        const auto expected =
+                values[size_t(percentile / 100.0 * (values.size() - 1))];
+        const auto actual = sketch.percentile(percentile);
+        EXPECT_NEAR(double(expected),
+                    double(actual),
+                    std::max(1.0, expected * accuracy))
+                << "percentile " << percentile;
+    }
+}
+
+TEST(QuantileSketchTest, TailResolution) {
+    // The tail is clearly different even if it would have ended up in
+    // the same bin of MicrosecondHistogram
+    cb::MicrosecondQuantileSketch a;
+    cb::MicrosecondQuantileSketch b;
+    for (int ii = 0; ii < 99; ++ii) {
+        a.add(std::chrono::microseconds(100));
+        b.add(std::chrono::microseconds(100));
+    }
+    a.add(std::chrono::microseconds(1200));
+    b.add(std::chrono::microseconds(1800));
+    EXPECT_NEAR(1200, a.percentile(100).count(), 12);
+    EXPECT_NEAR(1800, b.percentile(100).count(), 18);
+}
+
+TEST(QuantileSketchTest, SmallValues) {
+    cb::QuantileSketch<uint32_t> sketch;
+    sketch.add(0, 2);
+    sketch.add(1, 2);
+    sketch.add(2, 2);
+    EXPECT_EQ(0, sketch.percentile(0));
+    EXPECT_EQ(1, sketch.percentile(50));
+    EXPECT_EQ(2, sketch.percentile(100));
+
+    std::stringstream s;
+    s << sketch;
+    EXPECT_EQ("{QuantileSketch: [0, 1) = 2, [1, 2) = 2, [2, 3) = 2}",
+              s.str());
+}
+
+TEST(QuantileSketchTest, LargeValues) {
+    cb::QuantileSketch<uint32_t> sketch(0.01, 1000);
+    // Values above maxTrackableValue are counted in the last bucket
+    sketch.add(std::numeric_limits<uint32_t>::max());
+    EXPECT_EQ(1, sketch.total());
+    EXPECT_NEAR(1000, sketch.percentile(100), 10);
+}
+
+TEST(QuantileSketchTest, Merge) {
+    cb::QuantileSketch<uint32_t> a;
+    cb::QuantileSketch<uint32_t> b;
+    a.add(100, 50);
+    b.add(10000, 50);
+    a.merge(b);
+    EXPECT_EQ(100, a.total());
+    EXPECT_NEAR(100, a.percentile(25), 1);
+    EXPECT_NEAR(10000, a.percentile(75), 100);
+
+    cb::QuantileSketch<uint32_t> c(0.02);
+    EXPECT_THROW(a.merge(c), std::invalid_argument);
+
+    a.reset();
+    EXPECT_EQ(0, a.total());
+}
+
+TEST(QuantileSketchTest, BlockTimer) {
+    cb::MicrosecondQuantileSketch sketch;
+    {
+        GenericBlockTimer<cb::MicrosecondQuantileSketch, 0> timer(&sketch);
+    }
+    EXPECT_EQ(1, sketch.total());
+}
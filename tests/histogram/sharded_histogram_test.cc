@@ -0,0 +1,89 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+// Include the histogram header first to ensure that it is standalone
+#include <platform/sharded_histogram.h>
+
+#include <gtest/gtest.h>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+TEST(ShardedHistogramTest, OneShardPerCore) {
+    cb::ShardedHistogram<uint32_t> histo(1000000, 2);
+    EXPECT_EQ(cb::get_cpu_count(), histo.getNumShards());
+    EXPECT_EQ(histo.getLayout().size() * sizeof(size_t) * histo.getNumShards(),
+              histo.getMemoryUsage());
+}
+
+TEST(ShardedHistogramTest, AddFromManyThreads) {
+    cb::ShardedHistogram<uint32_t> histo(1000000, 2);
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < 4; ++ii) {
+        threads.emplace_back([&histo]() {
+            for (uint32_t value = 0; value < 1000; ++value) {
+                histo.add(value);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(4000, histo.total());
+
+    auto merged = histo.aggregate();
+    EXPECT_EQ(4000, merged.total());
+    EXPECT_EQ(4, merged.getBin(10).count());
+    EXPECT_EQ(histo.getLayout(), merged.getLayout());
+    EXPECT_EQ(merged.percentile(50), histo.percentile(50));
+
+    histo.reset();
+    EXPECT_EQ(0, histo.total());
+}
+
+TEST(ShardedHistogramTest, Drain) {
+    cb::ShardedHistogram<uint32_t> histo(1000000, 2);
+    histo.add(10, 2);
+    EXPECT_EQ(2, histo.snapshot().total());
+    auto delta = histo.drain();
+    EXPECT_EQ(2, delta.getBin(10).count());
+    EXPECT_EQ(0, histo.total());
+    histo.add(10);
+    EXPECT_EQ(1, histo.drain().total());
+}
+
+TEST(ShardedHistogramTest, Print) {
+    cb::ShardedHistogram<uint32_t> histo(1000, 1);
+    histo.add(5, 2);
+    std::stringstream s;
+    s << histo;
+    EXPECT_EQ("{LogLinearHistogram: [5, 6) = 2}", s.str());
+}
+
+TEST(ShardedHistogramTest, BlockTimer) {
+    cb::MicrosecondShardedHistogram histo(std::chrono::seconds(10), 2);
+    {
+        GenericBlockTimer<cb::MicrosecondShardedHistogram, 0> timer(&histo);
+    }
+    EXPECT_EQ(1, histo.total());
+}
+
+TEST(LogLinearHistogramTest, MergeRequiresSameLayout) {
+    cb::LogLinearHistogram<uint32_t> a(1000, 2);
+    cb::LogLinearHistogram<uint32_t> b(1000, 3);
+    EXPECT_THROW(a.merge(b), std::invalid_argument);
+}
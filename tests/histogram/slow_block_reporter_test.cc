@@ -0,0 +1,124 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/slow_block_reporter.h>
+
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+// Use a long interval in the tests so that the reports are only written
+// when we call flush() (or destroy the reporter)
+TEST(SlowBlockReporterTest, Report) {
+    std::stringstream out;
+    cb::SlowBlockReporter reporter(out, hours(1));
+    EXPECT_TRUE(reporter.report("test", milliseconds(5)));
+    reporter.flush();
+    EXPECT_EQ("BlockTimer<test> Took too long: 5ms\n", out.str());
+
+    // Nothing more to write
+    reporter.flush();
+    EXPECT_EQ("BlockTimer<test> Took too long: 5ms\n", out.str());
+}
+
+TEST(SlowBlockReporterTest, AggregatePerName) {
+    std::stringstream out;
+    cb::SlowBlockReporter reporter(out, hours(1));
+    reporter.report("a", milliseconds(5));
+    reporter.report("b", milliseconds(7));
+    reporter.report("a", milliseconds(9));
+    reporter.report("a", milliseconds(2));
+    reporter.flush();
+    EXPECT_EQ(
+            "BlockTimer<a> Took too long: 3 times, max 9ms\n"
+            "BlockTimer<b> Took too long: 7ms\n",
+            out.str());
+}
+
+TEST(SlowBlockReporterTest, LongNamesAreTruncated) {
+    std::stringstream out;
+    cb::SlowBlockReporter reporter(out, hours(1));
+    const std::string name(100, 'x');
+    reporter.report(name.c_str(), milliseconds(1));
+    reporter.flush();
+    EXPECT_EQ("BlockTimer<" +
+                      name.substr(0, cb::SlowBlockReporter::MaxNameLength) +
+                      "> Took too long: 1ms\n",
+              out.str());
+}
+
+TEST(SlowBlockReporterTest, DropWhenFull) {
+    std::stringstream out;
+    cb::SlowBlockReporter reporter(out, hours(1), 2);
+    EXPECT_TRUE(reporter.report("test", milliseconds(1)));
+    EXPECT_TRUE(reporter.report("test", milliseconds(1)));
+    EXPECT_FALSE(reporter.report("test", milliseconds(1)));
+    EXPECT_EQ(1, reporter.getDropped());
+    reporter.flush();
+    EXPECT_EQ(
+            "BlockTimer<test> Took too long: 2 times, max 1ms\n"
+            "BlockTimer: dropped 1 slow block reports\n",
+            out.str());
+
+    // The queue is usable again after being drained
+    EXPECT_TRUE(reporter.report("test", milliseconds(1)));
+}
+
+TEST(SlowBlockReporterTest, ManyThreads) {
+    std::stringstream out;
+    cb::SlowBlockReporter reporter(out, hours(1), 4096);
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < 4; ++ii) {
+        threads.emplace_back([&reporter, ii]() {
+            for (int jj = 0; jj < 100; ++jj) {
+                reporter.report("test", milliseconds(ii));
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    reporter.flush();
+    EXPECT_EQ("BlockTimer<test> Took too long: 400 times, max 3ms\n",
+              out.str());
+}
+
+TEST(SlowBlockReporterTest, PendingReportsAreWrittenOnShutdown) {
+    std::stringstream out;
+    {
+        cb::SlowBlockReporter reporter(out, hours(1));
+        reporter.report("test", milliseconds(5));
+    }
+    EXPECT_EQ("BlockTimer<test> Took too long: 5ms\n", out.str());
+}
+
+// The process-wide instance is never destroyed; the pending reports are
+// written at exit
+TEST(SlowBlockReporterTest, InstanceWritesPendingReportsAtExit) {
+    EXPECT_EXIT(
+            {
+                cb::SlowBlockReporter::instance().report("exit",
+                                                         milliseconds(5));
+                std::exit(0);
+            },
+            ::testing::ExitedWithCode(0),
+            "BlockTimer<exit> Took too long: 5ms");
+}
@@ -0,0 +1,118 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+// Include the histogram header first to ensure that it is standalone
+#include <platform/windowed_histogram.h>
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono;
+
+// A clock which only moves when we tell it to
+struct MockClockSource : cb::ProcessClockSource {
+    ProcessClock::time_point now() override {
+        return time;
+    }
+    ProcessClock::time_point time = ProcessClock::now();
+};
+
+class WindowedHistogramTest : public ::testing::Test {
+protected:
+    MockClockSource clock;
+    cb::WindowedHistogram<uint32_t> histo{seconds(1), 5, 1000000, 2, clock};
+};
+
+TEST_F(WindowedHistogramTest, InvalidConfig) {
+    EXPECT_THROW(cb::WindowedHistogram<uint32_t>(seconds(0), 5, 1000000, 2),
+                 std::invalid_argument);
+    EXPECT_THROW(cb::WindowedHistogram<uint32_t>(seconds(1), 0, 1000000, 2),
+                 std::invalid_argument);
+}
+
+TEST_F(WindowedHistogramTest, Window) {
+    // One value in each interval
+    for (uint32_t value = 1; value <= 5; ++value) {
+        histo.add(value * 100);
+        clock.time += seconds(1);
+        histo.tick();
+    }
+    histo.add(600);
+
+    // The current interval only
+    EXPECT_EQ(1, histo.total(seconds(0)));
+    EXPECT_EQ(600, histo.getWindow(seconds(0)).getBin(600).start());
+
+    // The current (partial) interval doesn't cover the window, so the
+    // previous interval is included
+    EXPECT_EQ(2, histo.total(milliseconds(1)));
+    EXPECT_EQ(2, histo.total(seconds(1)));
+
+    // The current interval and the 2 previous ones
+    auto window = histo.getWindow(seconds(2));
+    EXPECT_EQ(3, window.total());
+    EXPECT_EQ(1, window.getBin(400).count());
+    EXPECT_EQ(0, window.getBin(300).count());
+
+    // The oldest value (100) has been rotated out
+    EXPECT_EQ(5, histo.total(seconds(60)));
+    EXPECT_EQ(0, histo.getWindow().getBin(100).count());
+    EXPECT_EQ(1, histo.getWindow().getBin(200).count());
+}
+
+TEST_F(WindowedHistogramTest, QueriesRotate) {
+    histo.add(10, 10);
+    EXPECT_EQ(10, histo.total(seconds(5)));
+
+    clock.time += seconds(2);
+    EXPECT_EQ(0, histo.total(seconds(1)));
+    EXPECT_EQ(10, histo.total(seconds(3)));
+
+    // Everything is gone when more than the window has passed
+    clock.time += hours(1);
+    EXPECT_EQ(0, histo.total(seconds(5)));
+    histo.add(10);
+    EXPECT_EQ(1, histo.total(seconds(5)));
+}
+
+TEST_F(WindowedHistogramTest, Percentile) {
+    for (uint32_t value = 1; value <= 100; ++value) {
+        histo.add(value);
+    }
+    clock.time += seconds(1);
+    histo.tick();
+    histo.add(10000);
+    EXPECT_NEAR(10000, histo.percentile(50, seconds(0)), 100);
+    EXPECT_GT(10000, histo.percentile(50, seconds(1)));
+}
+
+TEST_F(WindowedHistogramTest, Reset) {
+    histo.add(10);
+    clock.time += seconds(1);
+    histo.add(10);
+    histo.reset();
+    EXPECT_EQ(0, histo.total(seconds(5)));
+}
+
+TEST(MicrosecondWindowedHistogramTest, BlockTimer) {
+    cb::MicrosecondWindowedHistogram histo(seconds(1), 61, seconds(10), 2);
+    EXPECT_EQ(histo.getWindow().getLayout().size() * sizeof(size_t) * 61,
+              histo.getMemoryUsage());
+    {
+        GenericBlockTimer<cb::MicrosecondWindowedHistogram, 0> timer(&histo);
+    }
+    EXPECT_EQ(1, histo.total(seconds(60)));
+}
@@ -18,7 +18,12 @@
 #include <benchmark/benchmark.h>
 #include <platform/make_unique.h>
 #include <platform/pipe.h>
+#include <platform/spsc_pipe.h>
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 // Benchmark copying data into a blob. This represents how we used to add
 // to the old write buffer
@@ -63,6 +68,154 @@ void ProduceWdata(benchmark::State& state) {
 }
 BENCHMARK(ProduceWdata);
 
+// Benchmark the cost of wrapping the producer in a std::function compared
+// to passing the lambda directly to the templated produce. The lambda
+// captures more state than fits in the small object buffer of
+// std::function so it'll allocate memory for every call.
+void ProduceStdFunction(benchmark::State& state) {
+    std::vector<uint8_t> blob(256);
+    cb::Pipe pipe(4096);
+    size_t offset = 0;
+    size_t total = 0;
+
+    while (state.KeepRunning()) {
+        pipe.clear();
+        pipe.produce(std::function<ssize_t(void*, size_t)>(
+                [&blob, &offset, &total](void* ptr, size_t size) -> ssize_t {
+                    std::copy(blob.begin() + offset,
+                              blob.end(),
+                              static_cast<uint8_t*>(ptr));
+                    total += blob.size() - offset;
+                    return blob.size() - offset;
+                }));
+    }
+    benchmark::DoNotOptimize(total);
+}
+BENCHMARK(ProduceStdFunction);
+
+void ProduceTemplate(benchmark::State& state) {
+    std::vector<uint8_t> blob(256);
+    cb::Pipe pipe(4096);
+    size_t offset = 0;
+    size_t total = 0;
+
+    while (state.KeepRunning()) {
+        pipe.clear();
+        pipe.produce(
+                [&blob, &offset, &total](void* ptr, size_t size) -> ssize_t {
+                    std::copy(blob.begin() + offset,
+                              blob.end(),
+                              static_cast<uint8_t*>(ptr));
+                    total += blob.size() - offset;
+                    return blob.size() - offset;
+                });
+    }
+    benchmark::DoNotOptimize(total);
+}
+BENCHMARK(ProduceTemplate);
+
+void ConsumeStdFunction(benchmark::State& state) {
+    cb::Pipe pipe(4096);
+    pipe.produce([](void*, size_t) -> ssize_t { return 4; });
+    size_t total = 0;
+    size_t calls = 0;
+    size_t limit = 4;
+
+    while (state.KeepRunning()) {
+        pipe.consume(std::function<ssize_t(cb::const_byte_buffer)>(
+                [&total, &calls, &limit](cb::const_byte_buffer data) {
+                    total += std::min(data.size(), limit);
+                    ++calls;
+                    return ssize_t(0);
+                }));
+    }
+    benchmark::DoNotOptimize(total);
+    benchmark::DoNotOptimize(calls);
+}
+BENCHMARK(ConsumeStdFunction);
+
+void ConsumeTemplate(benchmark::State& state) {
+    cb::Pipe pipe(4096);
+    pipe.produce([](void*, size_t) -> ssize_t { return 4; });
+    size_t total = 0;
+    size_t calls = 0;
+    size_t limit = 4;
+
+    while (state.KeepRunning()) {
+        pipe.consume([&total, &calls, &limit](cb::const_byte_buffer data) {
+            total += std::min(data.size(), limit);
+            ++calls;
+            return ssize_t(0);
+        });
+    }
+    benchmark::DoNotOptimize(total);
+    benchmark::DoNotOptimize(calls);
+}
+BENCHMARK(ConsumeTemplate);
+
+// Fill the pipe with frames with a 4 byte header containing the length
+// of the body
+static void fillFrames(cb::Pipe& pipe, size_t nframes, uint32_t bodysize) {
+    for (size_t ii = 0; ii < nframes; ++ii) {
+        pipe.produce([bodysize](cb::byte_buffer buffer) -> ssize_t {
+            std::copy(reinterpret_cast<const uint8_t*>(&bodysize),
+                      reinterpret_cast<const uint8_t*>(&bodysize) + 4,
+                      buffer.begin());
+            return bodysize + 4;
+        });
+    }
+}
+
+// Benchmark parsing frames out of the pipe by calling consume once
+// per frame (filling the pipe is included in the time, and is the same
+// for both of the frame benchmarks)
+void ConsumePerFrame(benchmark::State& state) {
+    cb::Pipe pipe(65536);
+    size_t frames = 0;
+    while (state.KeepRunning()) {
+        fillFrames(pipe, 32, 64);
+        while (pipe.consume([&frames](cb::const_byte_buffer data) -> ssize_t {
+            if (data.size() < 4) {
+                return 0;
+            }
+            uint32_t length;
+            std::copy(data.begin(),
+                      data.begin() + 4,
+                      reinterpret_cast<uint8_t*>(&length));
+            if (data.size() - 4 < length) {
+                return 0;
+            }
+            ++frames;
+            return length + 4;
+        }) != 0) {
+        }
+    }
+    benchmark::DoNotOptimize(frames);
+}
+BENCHMARK(ConsumePerFrame);
+
+// Benchmark parsing the same frames with consumeFrames
+void ConsumeFrames(benchmark::State& state) {
+    cb::Pipe pipe(65536);
+    size_t frames = 0;
+    while (state.KeepRunning()) {
+        fillFrames(pipe, 32, 64);
+        pipe.consumeFrames(
+                4,
+                [](cb::const_byte_buffer header) -> size_t {
+                    uint32_t length;
+                    std::copy(header.begin(),
+                              header.end(),
+                              reinterpret_cast<uint8_t*>(&length));
+                    return length;
+                },
+                [&frames](cb::sized_buffer<const cb::const_byte_buffer> batch) {
+                    frames += batch.size();
+                });
+    }
+    benchmark::DoNotOptimize(frames);
+}
+BENCHMARK(ConsumeFrames);
 
 // Benchmark calling the consume part of the pipe to check the data just
 // being sent points to the buffer (this represents the action we've added
@@ -94,5 +247,90 @@ void Rdata(benchmark::State& state) {
 }
 BENCHMARK(Rdata);
 
+// Benchmark moving data from one thread to another through a cb::Pipe
+// protected by a mutex (which is what you need to do with a cb::Pipe in
+// order to hand data between a network thread and a worker thread).
+void MutexPipeThroughput(benchmark::State& state) {
+    const size_t chunk = state.range(0);
+    cb::Pipe pipe(65536);
+    std::mutex mutex;
+    std::atomic<bool> done{false};
+
+    std::thread consumer([&pipe, &mutex, &done]() {
+        while (!done) {
+            std::unique_lock<std::mutex> guard(mutex);
+            if (pipe.consume([](cb::const_byte_buffer buffer) -> ssize_t {
+                    benchmark::DoNotOptimize(buffer.data());
+                    return buffer.size();
+                }) == 0) {
+                guard.unlock();
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    while (state.KeepRunning()) {
+        ssize_t nw = 0;
+        while (nw == 0) {
+            std::unique_lock<std::mutex> guard(mutex);
+            pipe.pack();
+            nw = pipe.produce([chunk](cb::byte_buffer buffer) -> ssize_t {
+                if (buffer.size() < chunk) {
+                    return 0;
+                }
+                std::fill(buffer.begin(), buffer.begin() + chunk, 'a');
+                return chunk;
+            });
+            if (nw == 0) {
+                guard.unlock();
+                std::this_thread::yield();
+            }
+        }
+    }
+    done = true;
+    consumer.join();
+    state.SetBytesProcessed(state.iterations() * chunk);
+}
+BENCHMARK(MutexPipeThroughput)->Arg(64)->Arg(1024)->Arg(16384);
+
+// Benchmark moving data from one thread to another through a lock-free
+// cb::SpscPipe
+void SpscPipeThroughput(benchmark::State& state) {
+    const size_t chunk = state.range(0);
+    cb::SpscPipe pipe(65536);
+    std::atomic<bool> done{false};
+
+    std::thread consumer([&pipe, &done]() {
+        while (!done) {
+            if (pipe.consume([](cb::const_byte_buffer buffer) -> ssize_t {
+                    benchmark::DoNotOptimize(buffer.data());
+                    return buffer.size();
+                }) == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    while (state.KeepRunning()) {
+        size_t nw = 0;
+        while (nw < chunk) {
+            const auto count = pipe.produce(
+                    [chunk, nw](cb::byte_buffer buffer) -> ssize_t {
+                        const auto count = std::min(chunk - nw, buffer.size());
+                        std::fill(buffer.begin(), buffer.begin() + count, 'a');
+                        return count;
+                    });
+            if (count == 0) {
+                std::this_thread::yield();
+            }
+            nw += count;
+        }
+    }
+    done = true;
+    consumer.join();
+    state.SetBytesProcessed(state.iterations() * chunk);
+}
+BENCHMARK(SpscPipeThroughput)->Arg(64)->Arg(1024)->Arg(16384);
+
 
 BENCHMARK_MAIN()
@@ -19,6 +19,9 @@
 
 #include <gtest/gtest.h>
 
+#include <memory>
+#include <thread>
+
 class PipeTest : public ::testing::Test {
 protected:
     cb::Pipe buffer;
@@ -34,6 +37,15 @@ TEST_F(PipeTest, DefaultSize) {
     EXPECT_TRUE(buffer.empty());
 }
 
+TEST(PipeMinimumSizeTest, MinimumSize) {
+    for (size_t size : {0, 1, 127, 128}) {
+        cb::Pipe pipe(size);
+        EXPECT_FALSE(pipe.isReleased());
+        EXPECT_EQ(128, pipe.capacity()) << "for size " << size;
+        EXPECT_EQ(128, pipe.wsize()) << "for size " << size;
+    }
+}
+
 TEST_F(PipeTest, EnsureCapacity) {
     buffer.ensureCapacity(100);
     EXPECT_EQ(buffer.capacity(), buffer.wsize());
@@ -199,3 +211,383 @@ TEST_F(PipeTest, RellocationSizes) {
         EXPECT_EQ(2048 << ii, pipe.ensureCapacity(pipe.capacity() + 1));
     }
 }
+
+TEST_F(PipeTest, MirroredWraparoundIsContiguous) {
+    cb::Pipe pipe(4096, cb::Pipe::Backing::Mirrored);
+    const auto capacity = pipe.capacity();
+    EXPECT_EQ(0, capacity % 4096);
+
+    // Move the heads close to the end of the buffer
+    pipe.produced(capacity - 10);
+    pipe.consumed(capacity - 20);
+    EXPECT_EQ(10, pipe.rsize());
+
+    // All of the free space is available after the write head
+    EXPECT_EQ(capacity - 10, pipe.wsize());
+    const auto* before = pipe.rdata().data();
+    EXPECT_FALSE(pipe.pack());
+    EXPECT_EQ(before, pipe.rdata().data());
+
+    const std::string message{"hello world, this wraps around"};
+    pipe.produce([&message](cb::byte_buffer buffer) -> ssize_t {
+        std::copy(message.begin(), message.end(), buffer.data());
+        return message.size();
+    });
+
+    // And the data is available as one contiguous segment
+    EXPECT_EQ(10 + message.size(), pipe.rsize());
+    pipe.consumed(10);
+    pipe.consume([&message](cb::const_byte_buffer buffer) -> ssize_t {
+        EXPECT_EQ(message,
+                  std::string(reinterpret_cast<const char*>(buffer.data()),
+                              buffer.size()));
+        return buffer.size();
+    });
+    EXPECT_TRUE(pipe.empty());
+}
+
+TEST_F(PipeTest, MirroredFullAndEnsureCapacity) {
+    cb::Pipe pipe(128, cb::Pipe::Backing::Mirrored);
+    const auto capacity = pipe.capacity();
+    pipe.produced(100);
+    pipe.consumed(50);
+    pipe.produce([](cb::byte_buffer buffer) -> ssize_t {
+        std::fill(buffer.begin(), buffer.end(), 'a');
+        return buffer.size();
+    });
+    EXPECT_TRUE(pipe.full());
+    EXPECT_EQ(capacity, pipe.rsize());
+
+    // Growing the pipe keeps the data
+    EXPECT_EQ(capacity, pipe.ensureCapacity(capacity));
+    EXPECT_EQ(capacity * 2, pipe.capacity());
+    EXPECT_EQ(capacity, pipe.rsize());
+    EXPECT_EQ(capacity, pipe.rdata().size());
+    EXPECT_EQ('a', pipe.rdata().data()[capacity - 1]);
+}
+
+TEST_F(PipeTest, ShrinkAfterIdleConsumes) {
+    buffer.setShrinkPolicy(2, std::chrono::milliseconds(0));
+    buffer.produced(10);
+    buffer.consume([](cb::const_byte_buffer data) -> ssize_t {
+        return data.size();
+    });
+    EXPECT_FALSE(buffer.isReleased());
+    buffer.consume([](cb::const_byte_buffer) -> ssize_t { return 0; });
+    EXPECT_TRUE(buffer.isReleased());
+    EXPECT_EQ(0, buffer.capacity());
+    EXPECT_EQ(0, buffer.wsize());
+
+    // The buffer is reacquired on the next produce
+    EXPECT_EQ(2048, buffer.produce([](cb::byte_buffer data) -> ssize_t {
+        return data.size();
+    }));
+    EXPECT_EQ(2048, buffer.capacity());
+}
+
+TEST_F(PipeTest, ShrinkAfterIdleTime) {
+    buffer.setShrinkPolicy(0, std::chrono::milliseconds(100));
+    const auto now = ProcessClock::now();
+    buffer.produced(10);
+    EXPECT_FALSE(buffer.releaseIfIdle(now));
+    buffer.consumed(10);
+
+    EXPECT_FALSE(buffer.releaseIfIdle(now));
+    EXPECT_FALSE(buffer.releaseIfIdle(now + std::chrono::milliseconds(50)));
+    EXPECT_TRUE(buffer.releaseIfIdle(now + std::chrono::milliseconds(100)));
+
+    // The buffer is reacquired by ensureCapacity
+    EXPECT_EQ(2048, buffer.ensureCapacity(100));
+    EXPECT_FALSE(buffer.isReleased());
+}
+
+TEST_F(PipeTest, ReleaseBufferRequiresEmptyPipe) {
+    buffer.produced(10);
+    EXPECT_FALSE(buffer.releaseBuffer());
+    buffer.consumed(10);
+    EXPECT_TRUE(buffer.releaseBuffer());
+}
+
+TEST_F(PipeTest, BuffersAreReturnedToThePool) {
+    auto& pool = cb::PipeBufferPool::instance();
+    pool.purge();
+    {
+        cb::Pipe pipe(4096);
+    }
+    // The buffer should be cached by the pool
+    auto json = pool.to_json();
+    EXPECT_EQ(4096, cJSON_GetObjectItem(json.get(), "cached_bytes")->valueint);
+
+    // and handed out again to the next pipe
+    cb::Pipe pipe(4096);
+    json = pool.to_json();
+    EXPECT_EQ(0, cJSON_GetObjectItem(json.get(), "cached_bytes")->valueint);
+    EXPECT_LE(4096, cJSON_GetObjectItem(json.get(), "in_use_bytes")->valueint);
+}
+
+TEST_F(PipeTest, StdFunctionCallbacks) {
+    // Callers holding a std::function should still be able to use it
+    // (and end up in the same implementation as the templated version)
+    std::function<ssize_t(void*, size_t)> producer =
+            [](void*, size_t) -> ssize_t { return 10; };
+    std::function<ssize_t(cb::byte_buffer)> bufferProducer =
+            [](cb::byte_buffer) -> ssize_t { return 10; };
+    EXPECT_EQ(10, buffer.produce(producer));
+    EXPECT_EQ(10, buffer.produce(bufferProducer));
+    EXPECT_EQ(20, buffer.rsize());
+
+    std::function<ssize_t(const void*, size_t)> consumer =
+            [](const void*, size_t) -> ssize_t { return 5; };
+    std::function<ssize_t(cb::const_byte_buffer)> bufferConsumer =
+            [](cb::const_byte_buffer data) -> ssize_t { return data.size(); };
+    EXPECT_EQ(5, buffer.consume(consumer));
+    EXPECT_EQ(15, buffer.consume(bufferConsumer));
+    EXPECT_TRUE(buffer.empty());
+}
+
+/// Produce the given string into the pipe
+static void produceString(cb::Pipe& pipe, const std::string& data) {
+    pipe.produce([&data](cb::byte_buffer buffer) -> ssize_t {
+        std::copy(data.begin(), data.end(), buffer.begin());
+        return data.size();
+    });
+}
+
+static std::string readString(const cb::Pipe& pipe) {
+    const auto rdata = pipe.rdata();
+    return {reinterpret_cast<const char*>(rdata.data()), rdata.size()};
+}
+
+TEST_F(PipeTest, ReservePrepend) {
+    EXPECT_EQ(24, buffer.reserve(24).size());
+    EXPECT_EQ(24, buffer.hsize());
+    EXPECT_EQ(0, buffer.rsize());
+    EXPECT_FALSE(buffer.empty());
+    EXPECT_THROW(buffer.reserve(24), std::logic_error);
+
+    const std::string body{"This is the body"};
+    produceString(buffer, body);
+    // The body isn't available until the header is in place
+    EXPECT_EQ(0, buffer.rsize());
+    const auto* bodyPtr = buffer.hdata().end();
+
+    const std::string header(24, 'h');
+    buffer.prepend({reinterpret_cast<const uint8_t*>(header.data()),
+                    header.size()});
+    EXPECT_EQ(0, buffer.hsize());
+
+    // The header and the body should be available as one segment and the
+    // body shouldn't have moved
+    EXPECT_EQ(bodyPtr - header.size(), buffer.rdata().data());
+    EXPECT_EQ(header + body, readString(buffer));
+
+    EXPECT_THROW(buffer.prepended(0), std::logic_error);
+    buffer.consumed(buffer.rsize());
+    EXPECT_TRUE(buffer.empty());
+}
+
+TEST_F(PipeTest, ReservePrependWithDataInThePipe) {
+    // An unsent response is still in the pipe when the next one is built
+    produceString(buffer, "first");
+    buffer.reserve(24);
+    produceString(buffer, "body");
+    EXPECT_EQ("first", readString(buffer));
+
+    // The consumer may still consume the data in front of the reservation
+    buffer.consumed(2);
+    EXPECT_THROW(buffer.consumed(4), std::logic_error);
+    EXPECT_EQ("rst", readString(buffer));
+
+    // A header shorter than the reservation moves the data in front of
+    // it (but not the body)
+    const auto* bodyPtr = buffer.hdata().end();
+    const std::string header{"header:"};
+    buffer.prepend({reinterpret_cast<const uint8_t*>(header.data()),
+                    header.size()});
+    EXPECT_EQ("rstheader:body", readString(buffer));
+    EXPECT_EQ(bodyPtr - header.size() - 3, buffer.rdata().data());
+}
+
+TEST_F(PipeTest, ReservationIsKeptWhenPackingAndGrowing) {
+    buffer.produced(100);
+    buffer.consumed(50);
+    buffer.reserve(16);
+    buffer.produced(10);
+    EXPECT_EQ(50, buffer.rsize());
+    EXPECT_FALSE(buffer.pack());
+    EXPECT_EQ(50, buffer.rsize());
+    EXPECT_EQ(buffer.rdata().end(), buffer.hdata().data());
+
+    const auto capacity = buffer.capacity();
+    buffer.ensureCapacity(capacity);
+    EXPECT_LT(capacity, buffer.capacity());
+    EXPECT_EQ(50, buffer.rsize());
+    EXPECT_EQ(16, buffer.hsize());
+    EXPECT_EQ(buffer.rdata().end(), buffer.hdata().data());
+
+    buffer.prepended(16);
+    EXPECT_EQ(76, buffer.rsize());
+
+    buffer.reserve(8);
+    buffer.clear();
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_EQ(0, buffer.hsize());
+}
+
+TEST_F(PipeTest, MirroredReservationWrapsAround) {
+    cb::Pipe pipe(4096, cb::Pipe::Backing::Mirrored);
+    const auto capacity = pipe.capacity();
+    pipe.produced(capacity - 10);
+    pipe.consumed(capacity - 20);
+
+    // The reservation (and the data after it) wraps into the mirror
+    pipe.reserve(30);
+    pipe.produced(40);
+    EXPECT_EQ(10, pipe.rsize());
+    pipe.consumed(10);
+    EXPECT_EQ(0, pipe.rsize());
+
+    pipe.prepended(20);
+    EXPECT_EQ(60, pipe.rsize());
+    pipe.consumed(60);
+    EXPECT_TRUE(pipe.empty());
+}
+
+/// Produce a frame with a one byte length header
+static void produceFrame(cb::Pipe& pipe, const std::string& body) {
+    pipe.produce([&body](cb::byte_buffer buffer) -> ssize_t {
+        buffer[0] = uint8_t(body.size());
+        std::copy(body.begin(), body.end(), buffer.begin() + 1);
+        return body.size() + 1;
+    });
+}
+
+TEST_F(PipeTest, ConsumeFrames) {
+    produceFrame(buffer, "hello");
+    produceFrame(buffer, "");
+    produceFrame(buffer, "world");
+    // And a partial frame (header claims 10 bytes, but only 3 is present)
+    buffer.produce([](cb::byte_buffer data) -> ssize_t {
+        data[0] = 10;
+        return 4;
+    });
+
+    const auto* start = buffer.rdata().data();
+    std::vector<std::string> bodies;
+    const auto bodyLength = [](cb::const_byte_buffer header) -> size_t {
+        return header[0];
+    };
+    EXPECT_EQ(3,
+              buffer.consumeFrames(
+                      1,
+                      bodyLength,
+                      [&bodies, start](cb::sized_buffer<
+                                       const cb::const_byte_buffer> frames) {
+                          // The frames point into the pipe
+                          EXPECT_EQ(start, frames[0].data());
+                          for (const auto& frame : frames) {
+                              bodies.emplace_back(
+                                      reinterpret_cast<const char*>(
+                                              frame.data() + 1),
+                                      frame.size() - 1);
+                          }
+                      }));
+    EXPECT_EQ((std::vector<std::string>{"hello", "", "world"}), bodies);
+
+    // The partial frame is left in the pipe
+    EXPECT_EQ(4, buffer.rsize());
+    bool called = false;
+    EXPECT_EQ(0,
+              buffer.consumeFrames(
+                      1,
+                      bodyLength,
+                      [&called](cb::sized_buffer<const cb::const_byte_buffer>) {
+                          called = true;
+                      }));
+    EXPECT_FALSE(called);
+    EXPECT_EQ(4, buffer.rsize());
+}
+
+TEST_F(PipeTest, ConsumeFramesRequiresHeader) {
+    EXPECT_THROW(buffer.consumeFrames(
+                         0,
+                         [](cb::const_byte_buffer) -> size_t { return 0; },
+                         [](cb::sized_buffer<const cb::const_byte_buffer>) {}),
+                 std::invalid_argument);
+}
+
+TEST_F(PipeTest, Statistics) {
+    auto& global = cb::PipeStatistics::instance();
+    global.reset();
+
+    cb::Pipe pipe(128);
+    EXPECT_FALSE(pipe.isStatisticsEnabled());
+    pipe.setStatisticsEnabled(true);
+    EXPECT_EQ(128, pipe.getStatistics().peak_capacity);
+
+    pipe.produce([](cb::byte_buffer buffer) -> ssize_t { return 100; });
+    pipe.consume([](cb::const_byte_buffer buffer) -> ssize_t { return 60; });
+    EXPECT_EQ(1, pipe.getStatistics().produce_calls);
+    EXPECT_EQ(1, pipe.getStatistics().consume_calls);
+
+    // Packing moves the 40 remaining bytes
+    pipe.pack();
+    EXPECT_EQ(1, pipe.getStatistics().packs);
+    EXPECT_EQ(40, pipe.getStatistics().bytes_moved);
+
+    // Growing the pipe copies them again
+    pipe.ensureCapacity(200);
+    EXPECT_EQ(1, pipe.getStatistics().reallocs);
+    EXPECT_EQ(80, pipe.getStatistics().bytes_moved);
+    EXPECT_EQ(256, pipe.getStatistics().peak_capacity);
+
+    EXPECT_EQ(1, global.getPacks());
+    EXPECT_EQ(1, global.getReallocs());
+    EXPECT_EQ(80, global.getBytesMoved());
+    EXPECT_LE(256, global.getPeakCapacity());
+
+    auto json = pipe.to_json();
+    auto* stats = cJSON_GetObjectItem(json.get(), "stats");
+    ASSERT_NE(nullptr, stats);
+    EXPECT_EQ(1, cJSON_GetObjectItem(stats, "reallocs")->valueint);
+    EXPECT_EQ(nullptr, cJSON_GetObjectItem(json.get(), "global_stats"));
+    auto* pool = cJSON_GetObjectItem(json.get(), "pool");
+    ASSERT_NE(nullptr, pool);
+    EXPECT_LE(256, cJSON_GetObjectItem(pool, "in_use_bytes")->valueint);
+
+    // Nothing is recorded in the process-wide counters when disabled
+    global.setEnabled(false);
+    pipe.produced(10);
+    pipe.consumed(20);
+    pipe.pack();
+    EXPECT_EQ(2, pipe.getStatistics().packs);
+    EXPECT_EQ(1, global.getPacks());
+    global.setEnabled(true);
+
+    // The counters of the pipe isn't updated when disabled
+    pipe.setStatisticsEnabled(false);
+    pipe.produce([](cb::byte_buffer buffer) -> ssize_t { return 10; });
+    EXPECT_EQ(1, pipe.getStatistics().produce_calls);
+    json = pipe.to_json();
+    EXPECT_EQ(nullptr, cJSON_GetObjectItem(json.get(), "stats"));
+    EXPECT_EQ(nullptr, cJSON_GetObjectItem(json.get(), "pool"));
+}
+
+TEST(PipeBufferPoolTest, AllocationSize) {
+    EXPECT_EQ(128, cb::PipeBufferPool::getAllocationSize(1));
+    EXPECT_EQ(128, cb::PipeBufferPool::getAllocationSize(128));
+    EXPECT_EQ(4096, cb::PipeBufferPool::getAllocationSize(3000));
+    EXPECT_EQ(1024 * 1024 + 1,
+              cb::PipeBufferPool::getAllocationSize(1024 * 1024 + 1));
+}
+
+TEST(PipeBufferPoolTest, ReleaseAfterThreadCacheIsDestroyed) {
+    // The thread local holder is constructed before the thread cache of
+    // the pool (which is created by the first allocation), so the pipe is
+    // destroyed after the thread cache when the thread exits.
+    std::thread thread([]() {
+        static thread_local std::unique_ptr<cb::Pipe> holder;
+        holder = std::make_unique<cb::Pipe>(1024);
+    });
+    thread.join();
+}
@@ -0,0 +1,133 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/segmented_pipe.h>
+
+#include <gtest/gtest.h>
+#include <array>
+
+class SegmentedPipeTest : public ::testing::Test {
+protected:
+    cb::SegmentedPipe buffer{128};
+};
+
+TEST_F(SegmentedPipeTest, DefaultSize) {
+    cb::SegmentedPipe pipe;
+    EXPECT_EQ(2048, pipe.capacity());
+    EXPECT_EQ(2048, pipe.produce([](void*, size_t size) -> ssize_t {
+        return size;
+    }));
+    EXPECT_TRUE(pipe.full());
+    EXPECT_EQ(2048, pipe.consume([](const void*, size_t size) -> ssize_t {
+        return size;
+    }));
+    EXPECT_TRUE(pipe.empty());
+}
+
+TEST_F(SegmentedPipeTest, ProduceOverfow) {
+    EXPECT_THROW(buffer.produce([](void*, size_t size) -> ssize_t {
+        return size + 1;
+    }),
+                 std::logic_error);
+}
+
+TEST_F(SegmentedPipeTest, ConsumeOverfow) {
+    EXPECT_THROW(buffer.consume([](const void*, size_t size) -> ssize_t {
+        return size + 1;
+    }),
+                 std::logic_error);
+}
+
+TEST_F(SegmentedPipeTest, EnsureCapacityAppendsChunks) {
+    buffer.produced(100);
+    const auto* first = buffer.rdata().data();
+
+    // We need 3 more chunks to fit 300 bytes (28 + 3 * 128)
+    EXPECT_EQ(28 + 3 * 128, buffer.ensureCapacity(300));
+    EXPECT_EQ(4 * 128, buffer.capacity());
+
+    // The data didn't move
+    EXPECT_EQ(first, buffer.rdata().data());
+    EXPECT_EQ(100, buffer.rsize());
+
+    // The contiguous write space is the rest of the first chunk
+    EXPECT_EQ(28, buffer.wdata().size());
+    std::array<cb::byte_buffer, 8> iov;
+    EXPECT_EQ(4, buffer.wdata(iov.data(), iov.size()));
+    EXPECT_EQ(28, iov[0].size());
+    EXPECT_EQ(128, iov[3].size());
+}
+
+TEST_F(SegmentedPipeTest, ProduceConsumeAcrossChunks) {
+    std::string message(300, 'a');
+    for (size_t ii = 0; ii < message.size(); ++ii) {
+        message[ii] = 'a' + (ii % 26);
+    }
+    buffer.ensureCapacity(message.size());
+
+    // "readv" the data into the pipe
+    std::array<cb::byte_buffer, 8> wiov;
+    const auto nw = buffer.wdata(wiov.data(), wiov.size());
+    size_t offset = 0;
+    for (size_t ii = 0; ii < nw && offset < message.size(); ++ii) {
+        const auto count = std::min(wiov[ii].size(), message.size() - offset);
+        std::copy(message.begin() + offset,
+                  message.begin() + offset + count,
+                  wiov[ii].data());
+        offset += count;
+    }
+    buffer.produced(message.size());
+    EXPECT_EQ(message.size(), buffer.rsize());
+
+    // Consume a bit from the first chunk
+    EXPECT_EQ(10, buffer.consume([](cb::const_byte_buffer data) -> ssize_t {
+        EXPECT_EQ(128, data.size());
+        EXPECT_EQ('a', data[0]);
+        return 10;
+    }));
+
+    // All of the rest of the data is available in 3 segments
+    std::array<cb::const_byte_buffer, 8> riov;
+    ASSERT_EQ(3, buffer.rdata(riov.data(), riov.size()));
+    std::string data;
+    for (size_t ii = 0; ii < 3; ++ii) {
+        data.append(reinterpret_cast<const char*>(riov[ii].data()),
+                    riov[ii].size());
+    }
+    EXPECT_EQ(message.substr(10), data);
+
+    // Consuming across the chunk boundary release the first chunk
+    const auto capacity = buffer.capacity();
+    buffer.consumed(200);
+    EXPECT_EQ(capacity - 128, buffer.capacity());
+    EXPECT_EQ(message.substr(210, buffer.rdata().size()),
+              std::string(reinterpret_cast<const char*>(buffer.rdata().data()),
+                          buffer.rdata().size()));
+
+    buffer.consumed(buffer.rsize());
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_TRUE(buffer.pack());
+}
+
+TEST_F(SegmentedPipeTest, Clear) {
+    buffer.ensureCapacity(1000);
+    buffer.produced(1000);
+    buffer.clear();
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_EQ(128, buffer.capacity());
+    EXPECT_EQ(128, buffer.wsize());
+}
@@ -0,0 +1,127 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/spsc_pipe.h>
+
+#include <gtest/gtest.h>
+#include <thread>
+
+class SpscPipeTest : public ::testing::Test {
+protected:
+    cb::SpscPipe buffer;
+};
+
+TEST_F(SpscPipeTest, DefaultSize) {
+    EXPECT_EQ(2048, buffer.capacity());
+    EXPECT_EQ(2048, buffer.produce([](void*, size_t size) -> ssize_t {
+        return size;
+    }));
+    EXPECT_TRUE(buffer.full());
+    EXPECT_EQ(2048, buffer.consume([](const void*, size_t size) -> ssize_t {
+        return size;
+    }));
+    EXPECT_TRUE(buffer.empty());
+}
+
+TEST_F(SpscPipeTest, CapacityRoundedToPowerOfTwo) {
+    EXPECT_EQ(128, cb::SpscPipe(1).capacity());
+    EXPECT_EQ(4096, cb::SpscPipe(2049).capacity());
+}
+
+TEST_F(SpscPipeTest, ProduceOverfow) {
+    EXPECT_THROW(buffer.produce([](void*, size_t size) -> ssize_t {
+        return size + 1;
+    }),
+                 std::logic_error);
+}
+
+TEST_F(SpscPipeTest, ConsumeOverfow) {
+    EXPECT_THROW(buffer.consume([](const void*, size_t size) -> ssize_t {
+        return size + 1;
+    }),
+                 std::logic_error);
+}
+
+TEST_F(SpscPipeTest, Wraparound) {
+    cb::SpscPipe pipe(128);
+    // Move the heads close to the end of the buffer
+    pipe.produced(120);
+    pipe.consumed(120);
+    EXPECT_TRUE(pipe.empty());
+
+    // The write space available is split in two segments
+    EXPECT_EQ(128, pipe.wsize());
+    EXPECT_EQ(8, pipe.wdata().size());
+    const std::string message{"hello world"};
+    pipe.produce([&message](cb::byte_buffer buffer) -> ssize_t {
+        std::copy(message.begin(), message.begin() + 8, buffer.data());
+        return 8;
+    });
+    pipe.produce([&message](cb::byte_buffer buffer) -> ssize_t {
+        EXPECT_EQ(120, buffer.size());
+        std::copy(message.begin() + 8, message.end(), buffer.data());
+        return message.size() - 8;
+    });
+    EXPECT_EQ(message.size(), pipe.rsize());
+
+    // And it needs two reads to get it all back out
+    std::string data;
+    while (!pipe.empty()) {
+        pipe.consume([&data](cb::const_byte_buffer buffer) -> ssize_t {
+            data.append(reinterpret_cast<const char*>(buffer.data()),
+                        buffer.size());
+            return buffer.size();
+        });
+    }
+    EXPECT_EQ(message, data);
+}
+
+TEST_F(SpscPipeTest, ProducerConsumerThreads) {
+    cb::SpscPipe pipe(256);
+    const uint32_t limit = 1000000;
+
+    std::thread producer([&pipe, limit]() {
+        uint32_t next = 0;
+        while (next < limit) {
+            if (pipe.produce([&next, limit](cb::byte_buffer buffer) -> ssize_t {
+                    size_t ii = 0;
+                    for (; ii < buffer.size() && next < limit; ++ii) {
+                        buffer[ii] = uint8_t(next++);
+                    }
+                    return ii;
+                }) == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint32_t expected = 0;
+    bool ok = true;
+    while (expected < limit) {
+        if (pipe.consume([&expected, &ok](cb::const_byte_buffer buffer) -> ssize_t {
+                for (const auto& c : buffer) {
+                    ok &= (c == uint8_t(expected++));
+                }
+                return buffer.size();
+            }) == 0) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    EXPECT_TRUE(ok);
+    EXPECT_TRUE(pipe.empty());
+}
@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <platform/ring_buffer.h>
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Every thread both pushes and pops (so the queue neither fills up nor
+// drains) to measure the cost of handing over an element under contention.
+cb::MPMCRingBuffer<uint64_t> sharedQueue(1024);
+void MPMCRingBufferPushPop(benchmark::State& state) {
+    uint64_t value = 0;
+    while (state.KeepRunning()) {
+        while (!sharedQueue.try_push(value)) {
+        }
+        while (!sharedQueue.try_pop(value)) {
+        }
+    }
+}
+BENCHMARK(MPMCRingBufferPushPop)->ThreadRange(1, 64)->UseRealTime();
+
+// As above, but pushing and popping batches of elements
+void MPMCRingBufferPushPopBatch(benchmark::State& state) {
+    const size_t batchSize = 16;
+    std::vector<uint64_t> input(batchSize);
+    std::vector<uint64_t> output(batchSize);
+    while (state.KeepRunning()) {
+        auto first = input.begin();
+        while (first != input.end()) {
+            first += sharedQueue.try_push(first, input.end());
+        }
+        size_t popped = 0;
+        while (popped < batchSize) {
+            popped += sharedQueue.try_pop(output.begin() + popped,
+                                          batchSize - popped);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batchSize);
+}
+BENCHMARK(MPMCRingBufferPushPopBatch)->ThreadRange(1, 64)->UseRealTime();
+
+// The same pattern with a std::deque protected by a mutex (what the queue
+// replaces)
+std::mutex mutex;
+std::deque<uint64_t> sharedDeque;
+void MutexDequePushPop(benchmark::State& state) {
+    uint64_t value = 0;
+    while (state.KeepRunning()) {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            sharedDeque.push_back(value);
+        }
+        std::lock_guard<std::mutex> guard(mutex);
+        value = sharedDeque.front();
+        sharedDeque.pop_front();
+    }
+}
+BENCHMARK(MutexDequePushPop)->ThreadRange(1, 64)->UseRealTime();
+
+BENCHMARK_MAIN()
@@ -17,6 +17,12 @@
 
 #include <gtest/gtest.h>
 #include <platform/ring_buffer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <thread>
 #include <vector>
 
 using cb::RingBuffer;
@@ -93,3 +99,184 @@ TYPED_TEST(RingBufferTest, testRingBuffer) {
         ASSERT_EQ(i + 1, rb[i]);
     }
 }
+
+TYPED_TEST(RingBufferTest, testRotate) {
+    TypeParam rb;
+    for (int i = 0; i < 10; i++) {
+        rb.push_back(i);
+    }
+
+    // Rotating makes the oldest element the newest one with its old value
+    auto& newest = rb.rotate();
+    ASSERT_EQ(&newest, &rb.back());
+    ASSERT_EQ(0, rb.back());
+    ASSERT_EQ(1, rb.front());
+    newest = 42;
+    ASSERT_EQ(42, rb.back());
+}
+
+TEST(RoundUpToPowerOfTwoTest, Values) {
+    EXPECT_EQ(1, cb::roundUpToPowerOfTwo(0));
+    EXPECT_EQ(1, cb::roundUpToPowerOfTwo(1));
+    EXPECT_EQ(4, cb::roundUpToPowerOfTwo(3));
+    EXPECT_EQ(1024, cb::roundUpToPowerOfTwo(1024));
+    EXPECT_EQ(2048, cb::roundUpToPowerOfTwo(1025));
+}
+
+TEST(MPMCRingBufferTest, CapacityIsPowerOfTwo) {
+    EXPECT_EQ(2, cb::MPMCRingBuffer<int>(0).capacity());
+    EXPECT_EQ(2, cb::MPMCRingBuffer<int>(1).capacity());
+    EXPECT_EQ(8, cb::MPMCRingBuffer<int>(8).capacity());
+    EXPECT_EQ(16, cb::MPMCRingBuffer<int>(9).capacity());
+}
+
+// A type counting the number of times it is copied
+struct CopyCounter {
+    CopyCounter() = default;
+    CopyCounter(const CopyCounter&) {
+        ++copies;
+    }
+    CopyCounter& operator=(const CopyCounter&) {
+        ++copies;
+        return *this;
+    }
+    static int copies;
+};
+int CopyCounter::copies = 0;
+
+TEST(MPMCRingBufferTest, PushCopiesOnce) {
+    cb::MPMCRingBuffer<CopyCounter> queue(2);
+    const CopyCounter value;
+    CopyCounter::copies = 0;
+    EXPECT_TRUE(queue.try_push(value));
+    EXPECT_EQ(1, CopyCounter::copies);
+    EXPECT_TRUE(queue.try_push(value));
+    EXPECT_EQ(2, CopyCounter::copies);
+
+    // The value isn't copied when the queue is full
+    EXPECT_FALSE(queue.try_push(value));
+    EXPECT_EQ(2, CopyCounter::copies);
+}
+
+TEST(MPMCRingBufferTest, PushPop) {
+    cb::MPMCRingBuffer<int> queue(4);
+    int value;
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.try_pop(value));
+
+    // The queue is FIFO and fails to push when full
+    for (int ii = 0; ii < 4; ++ii) {
+        EXPECT_TRUE(queue.try_push(ii));
+    }
+    EXPECT_EQ(4, queue.size());
+    EXPECT_FALSE(queue.try_push(4));
+
+    for (int lap = 0; lap < 3; ++lap) {
+        for (int ii = 0; ii < 4; ++ii) {
+            ASSERT_TRUE(queue.try_pop(value));
+            EXPECT_EQ(lap * 4 + ii, value);
+            EXPECT_TRUE(queue.try_push(lap * 4 + ii + 4));
+        }
+    }
+    EXPECT_EQ(4, queue.size());
+}
+
+TEST(MPMCRingBufferTest, MoveOnly) {
+    cb::MPMCRingBuffer<std::unique_ptr<int>> queue(2);
+    EXPECT_TRUE(queue.try_push(std::unique_ptr<int>(new int(42))));
+    std::unique_ptr<int> value;
+    ASSERT_TRUE(queue.try_pop(value));
+    ASSERT_TRUE(value);
+    EXPECT_EQ(42, *value);
+}
+
+TEST(MPMCRingBufferTest, Batch) {
+    cb::MPMCRingBuffer<int> queue(8);
+    std::vector<int> input{1, 2, 3, 4, 5};
+    EXPECT_EQ(5, queue.try_push(input.begin(), input.end()));
+    // Only room for 3 more
+    EXPECT_EQ(3, queue.try_push(input.begin(), input.end()));
+    EXPECT_EQ(0, queue.try_push(input.begin(), input.end()));
+
+    std::vector<int> output;
+    EXPECT_EQ(6, queue.try_pop(std::back_inserter(output), 6));
+    EXPECT_EQ(std::vector<int>({1, 2, 3, 4, 5, 1}), output);
+    output.clear();
+    EXPECT_EQ(2, queue.try_pop(std::back_inserter(output), 100));
+    EXPECT_EQ(std::vector<int>({2, 3}), output);
+    EXPECT_EQ(0, queue.try_pop(std::back_inserter(output), 100));
+}
+
+// Every element pushed by the producers is popped exactly once, and the
+// elements from each producer are popped in the order they were pushed
+TEST(MPMCRingBufferTest, ManyThreads) {
+    const int numProducers = 4;
+    const int numConsumers = 4;
+    const int numElements = 20000;
+    cb::MPMCRingBuffer<uint64_t> queue(64);
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < numProducers; ++ii) {
+        threads.emplace_back([&queue, ii]() {
+            const uint64_t id = uint64_t(ii) << 32;
+            int jj = 0;
+            while (jj < numElements) {
+                if (jj % 2) {
+                    if (queue.try_push(id | jj)) {
+                        ++jj;
+                    }
+                } else {
+                    // Push a batch of (up to) 3 elements
+                    std::vector<uint64_t> batch;
+                    const int end = std::min(jj + 3, int(numElements));
+                    for (int kk = jj; kk < end; ++kk) {
+                        batch.push_back(id | kk);
+                    }
+                    jj += queue.try_push(batch.begin(), batch.end());
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    std::atomic<int> popped{0};
+    std::vector<std::vector<uint64_t>> results(numConsumers);
+    for (int ii = 0; ii < numConsumers; ++ii) {
+        threads.emplace_back([&queue, &popped, &results, ii]() {
+            auto& result = results[ii];
+            while (popped < numProducers * numElements) {
+                size_t count = 0;
+                uint64_t value;
+                if (ii % 2) {
+                    count = queue.try_pop(std::back_inserter(result), 5);
+                } else if (queue.try_pop(value)) {
+                    result.push_back(value);
+                    count = 1;
+                }
+                popped += int(count);
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::vector<int> seen(numProducers * numElements);
+    for (const auto& result : results) {
+        std::vector<int> last(numProducers, -1);
+        for (const auto value : result) {
+            const auto producer = int(value >> 32);
+            const auto element = int(value & 0xffffffff);
+            ASSERT_LT(producer, numProducers);
+            ASSERT_LT(element, numElements);
+            EXPECT_LT(last[producer], element);
+            last[producer] = element;
+            ++seen[producer * numElements + element];
+        }
+    }
+    for (const auto count : seen) {
+        ASSERT_EQ(1, count);
+    }
+    EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,63 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <platform/trace_recorder.h>
+
+// The cost of recording an event (reading the clock and writing the event
+// into the ring of the thread)
+void TraceRecorderRecord(benchmark::State& state) {
+    static cb::TraceRecorder recorder;
+    uint64_t ii = 0;
+    while (state.KeepRunning()) {
+        recorder.record(1, ii++);
+    }
+}
+BENCHMARK(TraceRecorderRecord)->Threads(1)->Threads(4);
+
+// The cost of recording an event with a timestamp provided by the caller
+void TraceRecorderRecordWithTimestamp(benchmark::State& state) {
+    static cb::TraceRecorder recorder;
+    const auto now = ProcessClock::now();
+    uint64_t ii = 0;
+    while (state.KeepRunning()) {
+        recorder.record(now, 1, ii++);
+    }
+}
+BENCHMARK(TraceRecorderRecordWithTimestamp)->Threads(1)->Threads(4);
+
+// The cost of writing an event into a ring (excluding the clock)
+void TraceRingRecord(benchmark::State& state) {
+    cb::TraceRing ring(1024);
+    uint64_t ii = 0;
+    while (state.KeepRunning()) {
+        ring.record(ii, 1, ii, 0);
+        ++ii;
+    }
+}
+BENCHMARK(TraceRingRecord);
+
+void TraceRecorderDisabled(benchmark::State& state) {
+    cb::TraceRecorder recorder;
+    recorder.setEnabled(false);
+    while (state.KeepRunning()) {
+        recorder.record(1);
+    }
+}
+BENCHMARK(TraceRecorderDisabled);
+
+BENCHMARK_MAIN()
@@ -0,0 +1,212 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2018 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <platform/trace_recorder.h>
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(TraceRingTest, CapacityIsPowerOfTwo) {
+    EXPECT_EQ(1, cb::TraceRing(0).capacity());
+    EXPECT_EQ(8, cb::TraceRing(8).capacity());
+    EXPECT_EQ(16, cb::TraceRing(9).capacity());
+}
+
+TEST(TraceRingTest, Snapshot) {
+    cb::TraceRing ring(4);
+    std::vector<cb::TraceEvent> events;
+    ring.snapshot(0, events);
+    EXPECT_TRUE(events.empty());
+
+    ring.record(10, 1, 2, 3);
+    ring.record(20, 4, 5, 6);
+    ring.snapshot(7, events);
+    ASSERT_EQ(2, events.size());
+    EXPECT_EQ(10, events[0].timestamp);
+    EXPECT_EQ(7, events[0].thread);
+    EXPECT_EQ(1, events[0].id);
+    EXPECT_EQ(2, events[0].payload[0]);
+    EXPECT_EQ(3, events[0].payload[1]);
+    EXPECT_EQ(20, events[1].timestamp);
+    EXPECT_EQ(4, events[1].id);
+}
+
+TEST(TraceRingTest, OverwriteOldest) {
+    cb::TraceRing ring(4);
+    for (uint32_t ii = 0; ii < 10; ++ii) {
+        ring.record(ii, ii, 0, 0);
+    }
+    std::vector<cb::TraceEvent> events;
+    ring.snapshot(0, events);
+    ASSERT_EQ(4, events.size());
+    for (uint32_t ii = 0; ii < 4; ++ii) {
+        EXPECT_EQ(6 + ii, events[ii].id);
+    }
+}
+
+TEST(TraceRecorderTest, Record) {
+    cb::TraceRecorder recorder(8);
+    EXPECT_EQ(0, recorder.getNumThreads());
+    EXPECT_TRUE(recorder.snapshot().empty());
+
+    recorder.record(1, 2, 3);
+    recorder.record(4);
+    EXPECT_EQ(1, recorder.getNumThreads());
+
+    const auto events = recorder.snapshot();
+    ASSERT_EQ(2, events.size());
+    EXPECT_EQ(1, events[0].id);
+    EXPECT_EQ(2, events[0].payload[0]);
+    EXPECT_EQ(3, events[0].payload[1]);
+    EXPECT_EQ(4, events[1].id);
+    EXPECT_EQ(0, events[1].payload[0]);
+    EXPECT_LE(events[0].timestamp, events[1].timestamp);
+}
+
+TEST(TraceRecorderTest, RecordWithTimestamp) {
+    cb::TraceRecorder recorder(8);
+    const auto now = ProcessClock::now();
+    recorder.record(now + std::chrono::nanoseconds(10), 1, 2, 3);
+    recorder.record(now, 4);
+
+    // The events are sorted by the provided timestamps
+    const auto events = recorder.snapshot();
+    ASSERT_EQ(2, events.size());
+    EXPECT_EQ(4, events[0].id);
+    EXPECT_EQ(1, events[1].id);
+    EXPECT_EQ(2, events[1].payload[0]);
+    EXPECT_EQ(3, events[1].payload[1]);
+    EXPECT_EQ(10, events[1].timestamp - events[0].timestamp);
+    EXPECT_EQ(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               now.time_since_epoch())
+                               .count()),
+              events[0].timestamp);
+}
+
+TEST(TraceRecorderTest, Disabled) {
+    cb::TraceRecorder recorder(8);
+    recorder.setEnabled(false);
+    EXPECT_FALSE(recorder.isEnabled());
+    recorder.record(1);
+    EXPECT_TRUE(recorder.snapshot().empty());
+
+    recorder.setEnabled(true);
+    recorder.record(1);
+    EXPECT_EQ(1, recorder.snapshot().size());
+}
+
+// Each recorder has its own rings (the thread local cache of the ring must
+// not be shared between the recorders)
+TEST(TraceRecorderTest, MultipleRecorders) {
+    cb::TraceRecorder first(8);
+    cb::TraceRecorder second(8);
+    first.record(1);
+    second.record(2);
+    first.record(3);
+
+    const auto a = first.snapshot();
+    ASSERT_EQ(2, a.size());
+    EXPECT_EQ(1, a[0].id);
+    EXPECT_EQ(3, a[1].id);
+
+    const auto b = second.snapshot();
+    ASSERT_EQ(1, b.size());
+    EXPECT_EQ(2, b[0].id);
+}
+
+TEST(TraceRecorderTest, MergeThreads) {
+    const int numThreads = 4;
+    const int numEvents = 100;
+    cb::TraceRecorder recorder(numEvents);
+
+    std::vector<std::thread> threads;
+    for (int ii = 0; ii < numThreads; ++ii) {
+        threads.emplace_back([&recorder, ii]() {
+            for (int jj = 0; jj < numEvents; ++jj) {
+                recorder.record(ii, jj);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(numThreads, recorder.getNumThreads());
+    const auto events = recorder.snapshot();
+    ASSERT_EQ(numThreads * numEvents, events.size());
+    std::vector<uint64_t> next(numThreads);
+    for (size_t ii = 0; ii < events.size(); ++ii) {
+        if (ii > 0) {
+            EXPECT_LE(events[ii - 1].timestamp, events[ii].timestamp);
+        }
+        // The events from each thread are in the order they were recorded
+        ASSERT_LT(events[ii].id, numThreads);
+        EXPECT_EQ(next[events[ii].id]++, events[ii].payload[0]);
+    }
+}
+
+// Snapshots may be taken while the threads are recording
+TEST(TraceRecorderTest, SnapshotWhileRecording) {
+    cb::TraceRecorder recorder(16);
+    std::atomic<bool> stop{false};
+    std::thread writer([&recorder, &stop]() {
+        uint64_t ii = 0;
+        while (!stop) {
+            recorder.record(1, ii, ~ii);
+            ++ii;
+        }
+    });
+
+    for (int ii = 0; ii < 1000; ++ii) {
+        for (const auto& event : recorder.snapshot()) {
+            // A torn event would have a mismatched payload
+            EXPECT_EQ(~event.payload[0], event.payload[1]);
+        }
+    }
+    stop = true;
+    writer.join();
+}
+
+TEST(TraceRecorderTest, ToJson) {
+    cb::TraceRecorder recorder(8);
+    recorder.record(1, 0xff, 2);
+    recorder.record(3);
+
+    auto json = recorder.to_json();
+    auto* start = cJSON_GetObjectItem(json.get(), "start");
+    ASSERT_NE(nullptr, start);
+    EXPECT_EQ(cJSON_String, start->type);
+
+    auto* events = cJSON_GetObjectItem(json.get(), "events");
+    ASSERT_NE(nullptr, events);
+    ASSERT_EQ(2, cJSON_GetArraySize(events));
+
+    auto* event = cJSON_GetArrayItem(events, 0);
+    EXPECT_EQ(0, cJSON_GetObjectItem(event, "ts")->valueint);
+    EXPECT_EQ(0, cJSON_GetObjectItem(event, "thread")->valueint);
+    EXPECT_EQ(1, cJSON_GetObjectItem(event, "id")->valueint);
+    EXPECT_STREQ("0x00000000000000ff",
+                 cJSON_GetObjectItem(event, "a")->valuestring);
+    EXPECT_STREQ("0x0000000000000002",
+                 cJSON_GetObjectItem(event, "b")->valuestring);
+
+    event = cJSON_GetArrayItem(events, 1);
+    EXPECT_EQ(3, cJSON_GetObjectItem(event, "id")->valueint);
+    EXPECT_LE(0, cJSON_GetObjectItem(event, "ts")->valueint);
+}